@@ -18,12 +18,30 @@ if(USE_SYSTEM_XNNPACK)
     /usr/local/lib64
   )
 
-  if(XNNPACK_INCLUDE_DIR AND XNNPACK_LIBRARY)
+  # the threadpool is created by us, so pthreadpool is linked directly
+  find_path(PTHREADPOOL_INCLUDE_DIR
+    NAMES pthreadpool.h
+    PATHS /usr/include /usr/local/include
+  )
+
+  find_library(PTHREADPOOL_LIBRARY
+    NAMES pthreadpool
+    PATHS
+    /usr/lib
+    /usr/lib/aarch64-linux-gnu
+    /usr/local/lib
+    /usr/lib64
+    /usr/lib64/aarch64-linux-gnu
+    /usr/local/lib64
+  )
+
+  if(XNNPACK_INCLUDE_DIR AND XNNPACK_LIBRARY AND PTHREADPOOL_INCLUDE_DIR AND PTHREADPOOL_LIBRARY)
     add_library(XNNPACK::SysXNNPACK UNKNOWN IMPORTED)
 
     set_target_properties(XNNPACK::SysXNNPACK PROPERTIES
       IMPORTED_LOCATION ${XNNPACK_LIBRARY}
-      INTERFACE_INCLUDE_DIRECTORIES ${XNNPACK_INCLUDE_DIR}
+      INTERFACE_INCLUDE_DIRECTORIES "${XNNPACK_INCLUDE_DIR};${PTHREADPOOL_INCLUDE_DIR}"
+      INTERFACE_LINK_LIBRARIES ${PTHREADPOOL_LIBRARY}
     )
 
     try_compile(XNNPACK_VERSION_CORRECT
@@ -61,6 +79,9 @@ if(NOT USE_SYSTEM_XNNPACK)
   set(XNNPACK_BUILD_BENCHMARKS OFF CACHE BOOL "" FORCE)
 
   FetchContent_MakeAvailable(XNNPACK)
-  add_library(XNNPACK::XNNPACK ALIAS XNNPACK)
+  add_library(XNNPACK::XNNPACK INTERFACE IMPORTED)
+  set_target_properties(XNNPACK::XNNPACK PROPERTIES
+    INTERFACE_LINK_LIBRARIES "XNNPACK;pthreadpool"
+  )
 endif()
 
@@ -84,6 +84,27 @@ int main() {
 
   xnn_run_operator(NULL, NULL);
 
+  xnn_define_static_reduce(NULL, xnn_reduce_mean, 0, NULL, 0, 0, 0);
+
+  xnn_define_even_split2(NULL, 0, 0, 0, 0, 0);
+
+  xnn_define_concatenate2(NULL, 0, 0, 0, 0, 0);
+
+  xnn_define_static_transpose(NULL, 0, NULL, 0, 0, 0);
+
+  xnn_define_channelwise_quantized_tensor_value(
+    NULL, xnn_datatype_qcint8, NULL,
+    0, 0, NULL, NULL,
+    0, 0, NULL);
+
+  xnn_define_convert(NULL, 0, 0, 0);
+
+  struct xnn_weights_cache_provider weights_cache = {0};
+  weights_cache.look_up_or_insert = NULL;
+  xnn_create_runtime_v3(NULL, &weights_cache, NULL, 0, NULL);
+
+  pthreadpool_destroy(pthreadpool_create(0));
+
   return 0;
 }
 
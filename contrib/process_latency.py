@@ -1,36 +1,116 @@
 import re
+import struct
 import sys
 import numpy as np
 
-def main():
-    if len(sys.argv) < 2:
-        print(f"Usage: {sys.argv[0]} <input_file>")
-        sys.exit(1)
+# see include/latency_trace.hpp
+MAGIC = b"FITRACE\0"
+HEADER = struct.Struct("<8sII")
+RECORD = struct.Struct("<QQII")  # frame_id, time_ns, stage, thread
+STAGE_CAPTURE = 0
+STAGE_ALARM = 1
+# trace_stage_t in pipeline order, each marks the end of a step
+STAGES = [
+    (0, "capture"),
+    (2, "converted"),
+    (3, "queued"),
+    (4, "dequeued"),
+    (5, "preprocessed"),
+    (6, "conv_pre"),
+    (7, "maxpool"),
+    (8, "stage2"),
+    (9, "stage3"),
+    (10, "stage4"),
+    (11, "conv_post"),
+    (12, "mean"),
+    (13, "inferred"),
+    (14, "result"),
+    (15, "dispatched"),
+    (1, "alarm"),
+]
+PERCENTILES = [50, 90, 99]
 
-    filename = sys.argv[1]
-    pattern = re.compile(r"!!LATENCY (S|E) id=(\d+) time=(\d+)")
 
-    starts = {}
-    ends = {}
+def read_trace(filename):
+    """Yields (stage, frame_id, time_ns) from a binary trace."""
+    with open(filename, "rb") as f:
+        magic, version, record_size = HEADER.unpack(f.read(HEADER.size))
+        if magic != MAGIC:
+            raise ValueError(f"{filename}: not a latency trace")
+        if version != 1 or record_size != RECORD.size:
+            raise ValueError(f"{filename}: unsupported trace version {version}")
+        data = f.read()
+    usable = len(data) - len(data) % RECORD.size
+    for frame_id, time_ns, stage, _thread in RECORD.iter_unpack(data[:usable]):
+        yield stage, frame_id, time_ns
+
+
+def read_text_log(filename):
+    """Yields (stage, frame_id, time_ns) from the old "!!LATENCY" stdout lines."""
+    pattern = re.compile(r"!!LATENCY (S|E) id=(\d+) time=(\d+)")
     with open(filename, "r") as f:
         for line in f:
             match = pattern.match(line.strip())
             if match:
                 typ, id_, time = match.groups()
-                id_ = int(id_)
-                time = int(time)
+                yield STAGE_CAPTURE if typ == "S" else STAGE_ALARM, int(id_), int(time)
+
+
+def print_percentiles(rows):
+    """Prints one line of p50/p90/p99/max in ms per (name, samples_ms) row."""
+    width = max(len(name) for name, _ in rows)
+    header = "".join(f"{'p' + str(p):>9}" for p in PERCENTILES)
+    print(f"{'step':<{width}} {'count':>7}{header}{'max':>9}")
+    for name, samples in rows:
+        values = np.percentile(samples, PERCENTILES)
+        cells = "".join(f"{v:9.3f}" for v in values)
+        print(f"{name:<{width}} {len(samples):>7}{cells}{np.max(samples):9.3f}")
+
 
-                if typ == "S":
-                    starts[id_] = time
-                elif typ == "E":
-                    ends[id_] = time
+def stage_breakdown(times):
+    """
+    Rows of the time spent reaching each stage from the previous one seen
+    for the same frame. Stages a build doesn't report are skipped.
+    """
+    names = dict(STAGES)
+    steps = {}
+    for stages in times.values():
+        previous = None
+        for stage, _name in STAGES:
+            if stage not in stages:
+                continue
+            if previous is not None:
+                key = (previous, stage)
+                steps.setdefault(key, []).append((stages[stage] - stages[previous]) / 1_000_000)
+            previous = stage
+    order = {stage: i for i, (stage, _name) in enumerate(STAGES)}
+    rows = []
+    for (begin, end), samples in sorted(steps.items(), key=lambda kv: order[kv[0][1]]):
+        rows.append((f"{names[begin]} -> {names[end]}", np.array(samples)))
+    return rows
+
+
+def main():
+    if len(sys.argv) < 2:
+        print(f"Usage: {sys.argv[0]} <latency.trace | old stdout log>")
+        sys.exit(1)
+
+    filename = sys.argv[1]
+    with open(filename, "rb") as f:
+        is_trace = f.read(len(MAGIC)) == MAGIC
+    records = read_trace(filename) if is_trace else read_text_log(filename)
+
+    # frame id -> stage -> the first time it was reached
+    times = {}
+    for stage, id_, time in records:
+        # the first alarm to fire counts
+        times.setdefault(id_, {}).setdefault(stage, time)
 
     latencies_ms = []
-    for id_ in starts:
-        if id_ in ends:
-            latency_ns = ends[id_] - starts[id_]
-            latency_ms = latency_ns / 1_000_000
-            latencies_ms.append(latency_ms)
+    for stages in times.values():
+        if STAGE_CAPTURE in stages and STAGE_ALARM in stages:
+            latency_ns = stages[STAGE_ALARM] - stages[STAGE_CAPTURE]
+            latencies_ms.append(latency_ns / 1_000_000)
     if not latencies_ms:
         print("No valid latency pairs found.")
         sys.exit(1)
@@ -42,6 +122,12 @@ def main():
     print("Mean latency (ms):", mean_latency)
     print("Std deviation (ms):", std_latency)
 
+    # only frames that made it to an alarm, dropped ones would skew the steps
+    complete = {id_: stages for id_, stages in times.items()
+                if STAGE_CAPTURE in stages and STAGE_ALARM in stages}
+    print()
+    print("Per stage latency (ms):")
+    print_percentiles(stage_breakdown(complete) + [("total", latencies_ms)])
+
 if __name__ == "__main__":
     main()
-
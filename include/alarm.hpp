@@ -1,8 +1,11 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <functional>
 #include <string>
+#include <vector>
 
 #include "detection_result.hpp"
 
@@ -20,6 +23,12 @@ namespace rpi_rt {
     std::string api_host = "api.brevo.com";
     //! Path for webhook invocation
     std::string api_path = "/v3/smtp/email";
+    //! Port of the API host
+    int api_port = 443;
+    //! Talk TLS to the API host; plain HTTP is for local testing only
+    bool api_tls = true;
+    //! CA certificate to verify the API host with, the system's if empty
+    std::string ca_cert_path;
 
     //! The API key to be set in headers
     std::string api_key;
@@ -31,6 +40,38 @@ namespace rpi_rt {
     std::string to_email;
     //! Name of the email receiver
     std::string to_name = "FlameIris User";
+
+    //! Least time between two emails
+    std::chrono::seconds cooldown = std::chrono::hours{2};
+    //! Retries of a failed send
+    unsigned retries = 3;
+    //! Wait before the first retry, doubled for each one after
+    std::chrono::milliseconds retry_backoff{1000};
+  };
+
+  /**
+   * Configuration struct for alarming via a GPIO buzzer.
+   */
+  struct buzzer_config_t {
+    //! GPIO pin connected to the buzzer
+    int pin = 26;
+    //! Beep pattern, alternating on and off durations, repeated
+    std::vector<std::chrono::milliseconds> pattern = {
+      std::chrono::milliseconds{500}, std::chrono::milliseconds{250}};
+    //! How long the pattern keeps repeating after the last fire result
+    std::chrono::milliseconds hold{2000};
+  };
+
+  /**
+   * Counters of the results queued for an alarm.
+   */
+  struct alarm_stats_t {
+    //! Results reported
+    uint64_t reported = 0;
+    //! Results replaced by a newer one of the same kind before alarming
+    uint64_t coalesced = 0;
+    //! Results dropped because the alarm fell behind
+    uint64_t dropped = 0;
   };
 
   /**
@@ -53,17 +94,27 @@ namespace rpi_rt {
       /**
        * Reports a detection result.
        *
-       * Wakes up the run function to perform the actual alarming. Subclasses
-       * might have custom throttle implemented.
+       * Wakes up the run function right away to perform the actual
+       * alarming. Never blocks; a fire result is never lost to a no-fire
+       * one reported after it. Subclasses might have custom throttle
+       * implemented.
        *
-       * @param result The outcome reported by sensor and detection logic.
+       * @param result The outcome reported by sensor and detection logic,
+       *               shared read only with the other alarms.
        */
-      virtual void report(std::unique_ptr<detection_result_t> result) = 0;
+      virtual void report(std::shared_ptr<detection_result_t> result) = 0;
 
       /**
        * Stop the run function and return.
        */
       virtual void close() = 0;
+
+      /**
+       * Queue counters, all zero for alarms without a queue.
+       */
+      virtual alarm_stats_t stats() const {
+        return {};
+      }
   };
 
   /**
@@ -79,9 +130,22 @@ namespace rpi_rt {
    *
    * Adhere to the Interface Segregation Principle (ISP) in SOLID.
    *
-   * @param pin GPIO pin connected to the buzzer
+   * @param cfg The buzzer pin and beep pattern.
+   */
+  std::shared_ptr<alarm_t> create_buzzer_alarm(buzzer_config_t cfg);
+
+  /**
+   * The factory method for creating a alarm_t beeping through a callback
+   * instead of the GPIO buzzer, e.g. a fake recording the beeps.
+   *
+   * Adhere to the Interface Segregation Principle (ISP) in SOLID.
+   *
+   * @param cfg The beep pattern, the pin is unused.
+   * @param set_buzzer Turns the buzzer on with true and off with false,
+   *                   called from the run function.
    */
-  std::shared_ptr<alarm_t> create_buzzer_alarm(int pin);
+  std::shared_ptr<alarm_t> create_buzzer_alarm(buzzer_config_t cfg,
+      std::function<void (bool on)> set_buzzer);
 
   /**
    * The factory method for creating a alarm_t reporting via Brevo
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -26,10 +28,13 @@ namespace rpi_rt {
        * Provide an optional JPEG image attachment for vision-led detection
        * results.
        *
-       * Returns an empty vector if no such data is applicable
+       * Encoded on the first call and shared by every caller after, e.g.
+       * the email and the WebUI. Safe to call from several threads.
+       *
+       * Returns nullptr if no such data is applicable
        */
-      virtual std::vector<uint8_t> jpg_attachment() {
-        return {};
+      virtual std::shared_ptr<const std::vector<uint8_t>> jpg_attachment() {
+        return nullptr;
       };
       /**
        * Returns a positive frame id associated with input, if present
@@ -37,6 +42,13 @@ namespace rpi_rt {
       virtual uint64_t frame_id() const noexcept {
         return 0;
       }
+      /**
+       * Returns the index of the camera the input came from, 0 if there
+       * is only one or the input is not visual
+       */
+      virtual unsigned camera_id() const noexcept {
+        return 0;
+      }
   };
 }
 
@@ -5,14 +5,57 @@
 #include <string>
 #include <cstdint>
 #include <atomic>
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+#include "latency_trace.hpp"
 
 namespace rpi_rt {
 
+/// @cond PRIVATE_DETAILS
+
+namespace detail {
+  //! Alignment of frame buffers, a cache line and enough for any SIMD load
+  constexpr size_t frame_alignment = 64;
+  //! Alignment of pooled frame buffers, which are large and long lived
+  constexpr size_t pooled_frame_alignment = 4096;
+
+  /**
+   * Allocates uninitialized storage for count elements.
+   */
+  template <class Elem>
+  std::shared_ptr<Elem> make_aligned_buffer(size_t count, size_t alignment) {
+    static_assert(std::is_trivially_copyable_v<Elem> && std::is_trivially_destructible_v<Elem>,
+        "Frame buffers are never constructed");
+    size_t bytes = (count * sizeof(Elem) + alignment - 1) / alignment * alignment;
+    void* data = std::aligned_alloc(alignment, bytes ? bytes : alignment);
+    if (!data) {
+      throw std::bad_alloc();
+    }
+    return std::shared_ptr<Elem>(static_cast<Elem*>(data), [](Elem* p) {
+      std::free(p);
+    });
+  }
+}
+
+/// @endcond
+
 /**
  * The tensor container passed around by the vision sensor and detection logic.
  *
- * Assumes NHWC and N == 1, always use a compact mem layout.
+ * Assumes NHWC, always use a compact mem layout. Sensors and most code
+ * use N == 1; a batch of N images of the same shape is stored back to back.
+ *
+ * The buffer is reference counted: copies of a frame are cheap views of the
+ * same memory, use clone() for an independent copy. A frame can also wrap
+ * memory it does not own, like a mmapped capture buffer, which is handed
+ * back through the deleter once the last view is gone.
  *
  * Adhere to the Single Responsibility Principle (SRP) in SOLID.
  */
@@ -37,6 +80,42 @@ public:
     resize(height, width, channels);
   }
 
+  /**
+   * Construct and allocate a batch of frames.
+   *
+   * @param batch The number of images
+   * @param height The height of each image
+   * @param width The width of each image
+   * @param channels The channel count.
+   */
+  Frame(size_t batch, size_t height, size_t width, size_t channels) {
+    resize(batch, height, width, channels);
+  }
+
+  /**
+   * Construct a frame viewing an existing buffer.
+   *
+   * @param height The height of frame
+   * @param width The width of frame.
+   * @param channels The channel count.
+   * @param buffer At least height * width * channels elements. Its deleter
+   *               runs when the last copy of this frame is destroyed.
+   */
+  Frame(size_t height, size_t width, size_t channels, std::shared_ptr<Elem> buffer)
+    : height_(height), width_(width), channels_(channels), buffer_(std::move(buffer)) {}
+
+  /**
+   * Construct a batch of frames viewing an existing buffer.
+   *
+   * @param batch The number of images
+   * @param height The height of each image
+   * @param width The width of each image
+   * @param channels The channel count.
+   * @param buffer At least batch * height * width * channels elements.
+   */
+  Frame(size_t batch, size_t height, size_t width, size_t channels, std::shared_ptr<Elem> buffer)
+    : batch_(batch), height_(height), width_(width), channels_(channels), buffer_(std::move(buffer)) {}
+
   /**
    * Resize a frame.
    *
@@ -48,10 +127,43 @@ public:
    * @param channels The channel count.
    */
   void resize(size_t height, size_t width, size_t channels) {
+    resize(1, height, width, channels);
+  }
+
+  /**
+   * Resize a batch of frames.
+   *
+   * @param batch The number of images
+   * @param height The height of each image
+   * @param width The width of each image
+   * @param channels The channel count.
+   */
+  void resize(size_t batch, size_t height, size_t width, size_t channels) {
+    size_t old_size = buffer_ ? size() : 0;
+    batch_ = batch;
     width_ = width;
     height_ = height;
     channels_ = channels;
-    buffer_.resize(size());
+    if (size() != old_size) {
+      buffer_ = detail::make_aligned_buffer<Elem>(size(), detail::frame_alignment);
+      std::memset(static_cast<void*>(buffer_.get()), 0, size() * sizeof(Elem));
+    }
+  }
+
+  /**
+   * Returns a copy that does not share the buffer with this frame.
+   */
+  Frame clone() const {
+    Frame copy{batch(), height(), width(), channels()};
+    std::copy(data(), data() + size(), copy.data());
+    return copy;
+  }
+
+  /**
+   * The number of images, 1 unless allocated as a batch.
+   */
+  size_t batch() const noexcept {
+    return batch_;
   }
 
   /**
@@ -79,70 +191,120 @@ public:
    * The total count of elements in this frame.
    */
   size_t size() const noexcept {
-    return height() * width() * channels();
+    return batch() * height() * width() * channels();
   }
 
   /**
    * Returns the immutable pointer.
    */
   const Elem* data() const noexcept {
-    return buffer_.data();
+    return buffer_.get();
   }
 
   /**
    * Returns the mutable pointer.
    */
   Elem* data() noexcept {
-    return buffer_.data();
+    return buffer_.get();
   }
 
 private:
+  size_t batch_ = 1;
   size_t height_ = 0;
   size_t width_ = 0;
   size_t channels_ = 0;
-  std::vector<elem_t> buffer_;
+  std::shared_ptr<elem_t> buffer_;
 };
 
-/// @cond PRIVATE_DETAILS
+/**
+ * Recycles equally sized frame buffers, so a sensor producing a frame per
+ * capture does not allocate once it reached steady state.
+ *
+ * Buffers are page aligned and not initialized. A buffer is free again once
+ * no frame views it any more; the pool grows when all are in use.
+ *
+ * Adhere to the Single Responsibility Principle (SRP) in SOLID.
+ */
+template <class Elem>
+class FramePool {
+public:
+  /**
+   * Default constructor, call resize() before acquire().
+   */
+  FramePool() {}
 
-namespace jpeg_utils {
-  Frame<uint8_t> read_from_file(const std::string& filename);
-  void write_to_file(const Frame<uint8_t>& frame, const std::string& file);
-  std::vector<uint8_t> write_to_mem(const Frame<uint8_t>& frame);
-}
+  /**
+   * Construct a pool of frames of the given shape.
+   *
+   * @param height The height of frame
+   * @param width The width of frame.
+   * @param channels The channel count.
+   */
+  FramePool(size_t height, size_t width, size_t channels) {
+    resize(height, width, channels);
+  }
 
-namespace latency_assessment {
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
 
-namespace detail {
-  inline std::atomic<bool>& do_assessment_flag() {
-    static std::atomic<bool> flag = ATOMIC_VAR_INIT(false);
-    return flag;
+  /**
+   * Change the frame shape, dropping the pooled buffers.
+   *
+   * Frames acquired before keep their buffer until they are gone.
+   *
+   * @param height The height of frame
+   * @param width The width of frame.
+   * @param channels The channel count.
+   */
+  void resize(size_t height, size_t width, size_t channels) {
+    std::unique_lock lg{mut_};
+    height_ = height;
+    width_ = width;
+    channels_ = channels;
+    buffers_.clear();
   }
-}
 
-  inline void begin_assessment() {
-    detail::do_assessment_flag() = true;
-  } 
-
-  inline void end_assessment() {
-    detail::do_assessment_flag() = false;
-  } 
+  /**
+   * Returns a frame with a recycled buffer, or a new one if all are in use.
+   */
+  Frame<Elem> acquire() {
+    std::unique_lock lg{mut_};
+    for (const auto& buffer : buffers_) {
+      // only the pool holds it. Nobody else can take a reference now, and
+      // the fence pairs with the release decrement of the last frame, so
+      // its accesses to the buffer are done
+      if (buffer.use_count() == 1) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return Frame<Elem>{height_, width_, channels_, buffer};
+      }
+    }
+    buffers_.push_back(detail::make_aligned_buffer<Elem>(
+          height_ * width_ * channels_, detail::pooled_frame_alignment));
+    return Frame<Elem>{height_, width_, channels_, buffers_.back()};
+  }
 
-  inline uint64_t make_frame_id() {
-    static std::atomic<uint64_t> next_frame_id = ATOMIC_VAR_INIT(0);
-    return ++next_frame_id;
+  /**
+   * The number of buffers allocated so far.
+   */
+  size_t capacity() const {
+    std::unique_lock lg{mut_};
+    return buffers_.size();
   }
 
-  inline void report_timepoint(uint64_t frame_id, bool completed = false) {
-    if (!detail::do_assessment_flag())
-      return;
+private:
+  size_t height_ = 0;
+  size_t width_ = 0;
+  size_t channels_ = 0;
+  std::vector<std::shared_ptr<Elem>> buffers_;
+  mutable std::mutex mut_;
+};
 
-    auto tp = std::chrono::steady_clock::now();
-    std::cout << "!!LATENCY " << ( completed ? "E" : "S" )
-      << " id=" << frame_id
-      << " time=" << std::chrono::duration_cast<std::chrono::nanoseconds>(
-          tp.time_since_epoch()).count() << std::endl;
-  }
+/// @cond PRIVATE_DETAILS
+
+namespace jpeg_utils {
+  Frame<uint8_t> read_from_file(const std::string& filename);
+  void write_to_file(const Frame<uint8_t>& frame, const std::string& file);
+  std::vector<uint8_t> write_to_mem(const Frame<uint8_t>& frame);
 }
 
 /// @endcond
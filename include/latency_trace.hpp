@@ -0,0 +1,224 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace rpi_rt {
+
+/// @cond PRIVATE_DETAILS
+
+namespace latency_assessment {
+
+  /**
+   * Where in the pipeline a frame was seen, each marks the end of a step.
+   *
+   * The values are stored in trace files, only ever append new ones and
+   * keep contrib/process_latency.py in sync.
+   */
+  enum class trace_stage_t : uint32_t {
+    capture = 0,       //!< the sensor dequeued the frame
+    alarm = 1,         //!< an alarm handled the detection result
+    converted = 2,     //!< colorspace conversion to RGB done
+    queued = 3,        //!< handed to the inference thread
+    dequeued = 4,      //!< the inference thread took it
+    preprocessed = 5,  //!< resized and normalized into the model input
+    conv_pre = 6,      //!< Model::forward blocks ..
+    maxpool = 7,
+    stage2 = 8,
+    stage3 = 9,
+    stage4 = 10,
+    conv_post = 11,
+    mean = 12,
+    inferred = 13,     //!< .. forward done, logits ready
+    result = 14,       //!< the detection result is constructed
+    dispatched = 15,   //!< handed to the alarm
+  };
+
+  /**
+   * One fixed-size binary trace record, written to the trace file as is
+   * (native endianness).
+   */
+  struct trace_record_t {
+    uint64_t frame_id;
+    uint64_t time_ns;   //!< std::chrono::steady_clock
+    uint32_t stage;     //!< trace_stage_t
+    uint32_t thread;    //!< small per-process thread number
+  };
+  static_assert(sizeof(trace_record_t) == 24, "trace records are 24 bytes on disk");
+
+  //! First bytes of a trace file, followed by u32 version and u32 record size
+  constexpr char trace_magic[8] = {'F', 'I', 'T', 'R', 'A', 'C', 'E', '\0'};
+  constexpr uint32_t trace_version = 1;
+
+namespace detail {
+
+  /**
+   * Single producer single consumer ring of trace records.
+   *
+   * The owning thread appends, the drainer thread takes. A full ring
+   * drops the new record instead of waiting.
+   */
+  class trace_ring_t {
+    public:
+      static constexpr size_t capacity = 4096;
+
+      explicit trace_ring_t(uint32_t thread) : thread_(thread) {}
+
+      void push(uint64_t frame_id, uint64_t time_ns, uint32_t stage) noexcept {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == capacity) {
+          dropped_.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+        records_[head % capacity] = trace_record_t{frame_id, time_ns, stage, thread_};
+        head_.store(head + 1, std::memory_order_release);
+      }
+
+      /**
+       * Hands every record pushed so far to sink(const trace_record_t*, size_t)
+       * in at most two contiguous runs.
+       */
+      template <class Sink>
+      size_t drain(Sink&& sink) {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        uint64_t head = head_.load(std::memory_order_acquire);
+        size_t count = head - tail;
+        size_t begin = tail % capacity;
+        size_t first = std::min(count, capacity - begin);
+        if (first) {
+          sink(&records_[begin], first);
+        }
+        if (count > first) {
+          sink(&records_[0], count - first);
+        }
+        tail_.store(head, std::memory_order_release);
+        return count;
+      }
+
+      uint64_t dropped() const noexcept {
+        return dropped_.load(std::memory_order_relaxed);
+      }
+
+    private:
+      const uint32_t thread_;
+      // producer and consumer indices on their own cache lines
+      alignas(64) std::atomic<uint64_t> head_ = ATOMIC_VAR_INIT(0);
+      alignas(64) std::atomic<uint64_t> tail_ = ATOMIC_VAR_INIT(0);
+      alignas(64) std::atomic<uint64_t> dropped_ = ATOMIC_VAR_INIT(0);
+      std::array<trace_record_t, capacity> records_;
+  };
+
+  inline std::atomic<bool>& do_assessment_flag() {
+    static std::atomic<bool> flag = ATOMIC_VAR_INIT(false);
+    return flag;
+  }
+
+  /**
+   * Creates the ring of the calling thread and registers it with the
+   * drainer. Takes a lock, but only once per thread.
+   */
+  trace_ring_t& register_trace_ring();
+
+  inline trace_ring_t& thread_trace_ring() {
+    thread_local trace_ring_t* ring = &register_trace_ring();
+    return *ring;
+  }
+
+  //! The frames a thread works on, for code that doesn't know their ids
+  struct current_frames_t {
+    static constexpr size_t capacity = 16;
+    uint64_t ids[capacity];
+    size_t count = 0;
+  };
+
+  inline current_frames_t& current_frames() {
+    thread_local current_frames_t frames;
+    return frames;
+  }
+
+  inline uint64_t now_ns() noexcept {
+    auto tp = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+  }
+}
+
+  /**
+   * Starts recording trace records, and a thread appending them to the
+   * file every so often.
+   *
+   * @param path The trace file, overwritten. Decode it with
+   *             contrib/process_latency.py.
+   */
+  void begin_assessment(const std::string& path);
+
+  /**
+   * Stops recording, writes out what is left and closes the trace file.
+   *
+   * @return The number of records dropped because a ring was full.
+   */
+  uint64_t end_assessment();
+
+  inline uint64_t make_frame_id() {
+    static std::atomic<uint64_t> next_frame_id = ATOMIC_VAR_INIT(0);
+    return ++next_frame_id;
+  }
+
+  /**
+   * Records that the frame reached the stage, costs a clock read and a
+   * store into the ring of the calling thread.
+   */
+  inline void report_timepoint(uint64_t frame_id, trace_stage_t stage) noexcept {
+    if (!detail::do_assessment_flag().load(std::memory_order_relaxed))
+      return;
+
+    detail::thread_trace_ring().push(frame_id, detail::now_ns(), static_cast<uint32_t>(stage));
+  }
+
+  /**
+   * Records that every frame of the enclosing trace_frames_scope_t reached
+   * the stage, for code like the model that works on a whole batch.
+   */
+  inline void report_timepoint(trace_stage_t stage) noexcept {
+    if (!detail::do_assessment_flag().load(std::memory_order_relaxed))
+      return;
+
+    const auto& frames = detail::current_frames();
+    uint64_t time_ns = detail::now_ns();
+    auto& ring = detail::thread_trace_ring();
+    for (size_t i = 0; i < frames.count; i++) {
+      ring.push(frames.ids[i], time_ns, static_cast<uint32_t>(stage));
+    }
+  }
+
+  /**
+   * Names the frames the calling thread works on until the scope ends.
+   * Frames beyond current_frames_t::capacity are not traced.
+   */
+  class trace_frames_scope_t {
+    public:
+      template <class Iter, class IdOf>
+      trace_frames_scope_t(Iter begin, Iter end, IdOf id_of) noexcept {
+        auto& frames = detail::current_frames();
+        frames.count = 0;
+        for (; begin != end && frames.count < detail::current_frames_t::capacity; ++begin) {
+          frames.ids[frames.count++] = id_of(*begin);
+        }
+      }
+
+      ~trace_frames_scope_t() {
+        detail::current_frames().count = 0;
+      }
+
+      trace_frames_scope_t(const trace_frames_scope_t&) = delete;
+      trace_frames_scope_t& operator=(const trace_frames_scope_t&) = delete;
+  };
+}
+
+/// @endcond
+
+}
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <functional>
+#include <future>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "frame.hpp"
 #include "detection_result.hpp"
@@ -11,6 +15,21 @@ namespace rpi_rt {
  *  @{
  */
 
+  /**
+   * A captured frame tagged with the camera it came from.
+   */
+  struct camera_frame_t {
+    //! Index of the camera, in the order the cameras were given
+    unsigned camera_id = 0;
+    //! For latency assessment
+    uint64_t frame_id = 0;
+    //! 3 channels RGB
+    Frame<uint8_t> frame;
+    //! Requests a full resolution capture if frame is downscaled, may be
+    //! empty. See camera_sensor_t::capture_full_resolution
+    std::function<std::shared_future<Frame<uint8_t>> ()> full_resolution;
+  };
+
   /**
    * The base class for Visual Classifying Models
    *
@@ -33,6 +52,51 @@ namespace rpi_rt {
        * @return The logit output. Use sigmoid to get the probability.
        */
       virtual float process(const Frame<uint8_t>& frame) = 0;
+
+      /**
+       * Perform classification of several frames, in one pass if the model
+       * supports batching.
+       *
+       * @param frames The frame inputs. Should have 3 channels RGB.
+       * @return The logit output of each frame.
+       */
+      virtual std::vector<float> process_batch(const std::vector<Frame<uint8_t>>& frames) {
+        std::vector<float> logits;
+        for (const auto& frame : frames) {
+          logits.push_back(process(frame));
+        }
+        return logits;
+      }
+  };
+
+  /**
+   * The numeric precision the ShuffleNetV2OnFire model runs in.
+   */
+  enum class shufflenet_precision_t {
+    //! fp32 end to end
+    fp32,
+    //! fp16 weights and activations; subgraph backend only, needs fp16
+    //! arithmetic such as ARMv8.2 (Raspberry Pi 5)
+    fp16,
+    //! int8 activations and per-channel int8 weights; subgraph backend only,
+    //! needs a calibration file, see calibrate_shufflenet_model()
+    qs8,
+  };
+
+  /**
+   * Configuration struct for the ShuffleNetV2OnFire model.
+   */
+  struct shufflenet_config_t {
+    //! Threads of the process-wide XNNPACK threadpool; 0 for one per core
+    size_t inference_threads = 0;
+    //! The numeric precision to run in
+    shufflenet_precision_t precision = shufflenet_precision_t::fp32;
+    //! Images per forward pass, e.g. one per camera
+    size_t batch_size = 1;
+    //! Time every operator and write a Chrome trace here when the model is
+    //! destroyed, also printing a table; operator backend only, empty to
+    //! disable
+    std::string profile_path;
   };
 
   /**
@@ -43,8 +107,49 @@ namespace rpi_rt {
    * The model must be setup with data from PROJECT_ROOT/testdata/model
    *
    * Adhere to the Interface Segregation Principle (ISP) in SOLID.
+   *
+   * @param cfg The model configuration.
+   */
+  std::shared_ptr<visual_classfying_model_t> create_shufflenet_model(shufflenet_config_t cfg = {});
+
+  /**
+   * The factory method for creating a ShuffleNetV2OnFire visual classification
+   * model lowered into a single XNNPACK subgraph.
+   *
+   * Same model data and output as create_shufflenet_model(), but XNNPACK
+   * fuses the operators and plans the intermediate memory.
+   *
+   * Adhere to the Interface Segregation Principle (ISP) in SOLID.
+   *
+   * @param cfg The model configuration.
+   */
+  std::shared_ptr<visual_classfying_model_t> create_shufflenet_subgraph_model(shufflenet_config_t cfg = {});
+
+  /**
+   * Record the activation ranges needed by the qs8 ShuffleNetV2OnFire model.
+   *
+   * Runs the fp32 model over the given JPEG images and writes the result to
+   * MODEL_PATH/calibration (MODEL_PATH.calibration for a packed model file),
+   * where the qs8 model picks it up on setup.
+   *
+   * @param model_path The model directory, e.g. PROJECT_ROOT/testdata/model,
+   *                   or a packed model file
+   * @param jpeg_files Representative images of the deployment scene.
+   */
+  void calibrate_shufflenet_model(const std::string& model_path,
+      const std::vector<std::string>& jpeg_files);
+
+  /**
+   * Pack a ShuffleNetV2OnFire model directory into a single file.
+   *
+   * The file is versioned and checksummed, and both models set up from it
+   * map the weights instead of reading and copying ~100 files. It replaces
+   * FILE only once it's complete.
+   *
+   * @param model_dir The model directory, e.g. PROJECT_ROOT/testdata/model
+   * @param file The packed model file to write.
    */
-  std::shared_ptr<visual_classfying_model_t> create_shufflenet_model();
+  void pack_shufflenet_model(const std::string& model_dir, const std::string& file);
 
   /**
    * Implements the logic for visual classification.
@@ -104,6 +209,14 @@ namespace rpi_rt {
        */
       void process(uint64_t frame_id, const Frame<uint8_t>& frame);
 
+      /**
+       * Perform the detection on frames of several cameras in one model
+       * pass, reporting a result tagged with the camera id for each.
+       *
+       * @param frames At most one frame per camera.
+       */
+      void process_batch(const std::vector<camera_frame_t>& frames);
+
       /**
        * Get the logit for last detection.
        */
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace rpi_rt {
+
+/** \addtogroup Threads
+ *  @{
+ */
+
+  /**
+   * Slots handing the newest item from producers to one consumer thread.
+   *
+   * Posting over an item nobody took yet replaces it and counts it as
+   * dropped, so a producer never blocks on a slow consumer and the
+   * consumer always gets the freshest item. Producers that must not
+   * replace each other's items, e.g. one per camera, post to their own slot.
+   *
+   * The lock only guards moving the item in and out; a replaced item is
+   * destroyed after the lock is released.
+   *
+   * Adhere to the Single Responsibility Principle (SRP) in SOLID.
+   */
+  template <class T>
+  class LatestMailbox {
+    public:
+      /**
+       * @param slots The number of independent slots.
+       */
+      explicit LatestMailbox(size_t slots = 1)
+        : items_(slots) {}
+      LatestMailbox(const LatestMailbox&) = delete;
+      LatestMailbox& operator=(const LatestMailbox&) = delete;
+
+      /**
+       * Puts an item into a slot, replacing the one waiting there.
+       *
+       * @return true if a waiting item was dropped.
+       */
+      bool post(T item, size_t slot = 0) {
+        std::optional<T> stale;
+        {
+          std::unique_lock lg{mut_};
+          auto& waiting = items_.at(slot);
+          posted_++;
+          if (waiting) {
+            dropped_++;
+            stale = std::move(waiting);
+          }
+          waiting = std::move(item);
+        }
+        cond_.notify_one();
+        return stale.has_value();
+      }
+
+      /**
+       * Takes an item, waiting for one to be posted. With several slots the
+       * lowest one holding an item wins.
+       *
+       * @return std::nullopt once closed and empty.
+       */
+      std::optional<T> wait() {
+        std::unique_lock lg{mut_};
+        cond_.wait(lg, [this]{ return ready() || closed_; });
+        return take();
+      }
+
+      /**
+       * Takes an item, waiting at most the timeout for one to be posted.
+       *
+       * @return std::nullopt on timeout, or once closed and empty.
+       */
+      template <class Rep, class Period>
+      std::optional<T> wait_for(std::chrono::duration<Rep, Period> timeout) {
+        std::unique_lock lg{mut_};
+        cond_.wait_for(lg, timeout, [this]{ return ready() || closed_; });
+        return take();
+      }
+
+      /**
+       * Takes the items of every slot holding one, in slot order, waiting
+       * for at least one to be posted.
+       *
+       * @return empty once closed and empty.
+       */
+      std::vector<T> wait_all() {
+        std::vector<T> items;
+        std::unique_lock lg{mut_};
+        cond_.wait(lg, [this]{ return ready() || closed_; });
+        while (auto item = take()) {
+          items.push_back(std::move(*item));
+        }
+        return items;
+      }
+
+      /**
+       * Wakes up the consumer for good, wait() returns std::nullopt once
+       * the last item is taken.
+       */
+      void close() {
+        {
+          std::unique_lock lg{mut_};
+          closed_ = true;
+        }
+        cond_.notify_all();
+      }
+
+      /**
+       * The number of items posted so far.
+       */
+      uint64_t posted() const {
+        std::unique_lock lg{mut_};
+        return posted_;
+      }
+
+      /**
+       * The number of items replaced before anyone took them.
+       */
+      uint64_t dropped() const {
+        std::unique_lock lg{mut_};
+        return dropped_;
+      }
+
+    private:
+      bool ready() const {
+        for (const auto& item : items_) {
+          if (item) {
+            return true;
+          }
+        }
+        return false;
+      }
+
+      std::optional<T> take() {
+        for (auto& waiting : items_) {
+          if (waiting) {
+            std::optional<T> item = std::move(waiting);
+            waiting.reset();
+            return item;
+          }
+        }
+        return std::nullopt;
+      }
+
+      mutable std::mutex mut_;
+      std::condition_variable cond_;
+      std::vector<std::optional<T>> items_;
+      bool closed_ = false;
+      uint64_t posted_ = 0;
+      uint64_t dropped_ = 0;
+  };
+
+  /**
+   * A bounded queue handing alarm events from producers to one consumer
+   * thread, in order.
+   *
+   * Unlike LatestMailbox nothing urgent is ever replaced by something less
+   * urgent: a fire result waits until the consumer takes it, however many
+   * no-fire results follow. With coalescing on, an event replaces the
+   * newest waiting one of the same urgency, so a burst collapses into its
+   * latest event. Once full, a new event is dropped unless it is urgent, in
+   * which case the oldest waiting event goes, the least urgent first.
+   * Producers never block.
+   *
+   * Adhere to the Single Responsibility Principle (SRP) in SOLID.
+   */
+  template <class T>
+  class AlarmMailbox {
+    public:
+      /**
+       * @param capacity The most events waiting at once.
+       * @param coalesce Whether an event replaces the newest waiting one of
+       *                 the same urgency.
+       */
+      explicit AlarmMailbox(size_t capacity = 16, bool coalesce = false)
+        : capacity_(capacity ? capacity : 1), coalesce_(coalesce) {}
+      AlarmMailbox(const AlarmMailbox&) = delete;
+      AlarmMailbox& operator=(const AlarmMailbox&) = delete;
+
+      /**
+       * Queues an event, waking up the consumer right away.
+       *
+       * @param urgent If the event must not give way to non-urgent ones.
+       * @return false if an event, this or a waiting one, was coalesced or
+       *         dropped.
+       */
+      bool post(T item, bool urgent) {
+        std::optional<T> stale;
+        {
+          std::unique_lock lg{mut_};
+          posted_++;
+          if (closed_) {
+            dropped_++;
+            return false;
+          }
+          if (coalesce_ && !items_.empty() && items_.back().urgent == urgent) {
+            coalesced_++;
+            stale = std::move(items_.back().item);
+            items_.back().item = std::move(item);
+          } else if (items_.size() < capacity_) {
+            items_.push_back(event_t{std::move(item), urgent});
+          } else if (!urgent) {
+            dropped_++;
+            return false;
+          } else {
+            dropped_++;
+            auto victim = items_.begin();
+            for (auto it = items_.begin(); it != items_.end(); ++it) {
+              if (!it->urgent) {
+                victim = it;
+                break;
+              }
+            }
+            stale = std::move(victim->item);
+            items_.erase(victim);
+            items_.push_back(event_t{std::move(item), urgent});
+          }
+        }
+        cond_.notify_one();
+        return !stale.has_value();
+      }
+
+      /**
+       * Takes the oldest event, waiting for one to be posted.
+       *
+       * @return std::nullopt once closed and empty.
+       */
+      std::optional<T> wait() {
+        std::unique_lock lg{mut_};
+        cond_.wait(lg, [this]{ return !items_.empty() || closed_; });
+        return take();
+      }
+
+      /**
+       * Takes the oldest event, waiting at most the timeout for one.
+       *
+       * @return std::nullopt on timeout, or once closed and empty.
+       */
+      template <class Rep, class Period>
+      std::optional<T> wait_for(std::chrono::duration<Rep, Period> timeout) {
+        std::unique_lock lg{mut_};
+        cond_.wait_for(lg, timeout, [this]{ return !items_.empty() || closed_; });
+        return take();
+      }
+
+      /**
+       * Wakes up the consumer for good, wait() returns std::nullopt once
+       * the events waiting are taken. Later posts are dropped.
+       */
+      void close() {
+        {
+          std::unique_lock lg{mut_};
+          closed_ = true;
+        }
+        cond_.notify_all();
+      }
+
+      /**
+       * Whether close() was called.
+       */
+      bool closed() const {
+        std::unique_lock lg{mut_};
+        return closed_;
+      }
+
+      /**
+       * The number of events posted so far.
+       */
+      uint64_t posted() const {
+        std::unique_lock lg{mut_};
+        return posted_;
+      }
+
+      /**
+       * The number of events replaced by a newer one of the same urgency.
+       */
+      uint64_t coalesced() const {
+        std::unique_lock lg{mut_};
+        return coalesced_;
+      }
+
+      /**
+       * The number of events dropped for lack of room or after close().
+       */
+      uint64_t dropped() const {
+        std::unique_lock lg{mut_};
+        return dropped_;
+      }
+
+    private:
+      struct event_t {
+        T item;
+        bool urgent;
+      };
+
+      std::optional<T> take() {
+        if (items_.empty()) {
+          return std::nullopt;
+        }
+        std::optional<T> item = std::move(items_.front().item);
+        items_.pop_front();
+        return item;
+      }
+
+      mutable std::mutex mut_;
+      std::condition_variable cond_;
+      std::deque<event_t> items_;
+      size_t capacity_;
+      bool coalesce_;
+      bool closed_ = false;
+      uint64_t posted_ = 0;
+      uint64_t coalesced_ = 0;
+      uint64_t dropped_ = 0;
+  };
+
+/** @}*/
+
+}
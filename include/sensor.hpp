@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <functional>
+#include <future>
 #include <cstdint>
 
 #include "frame.hpp"
@@ -47,6 +48,21 @@ namespace rpi_rt {
     bool ntc_top = false;
   };
 
+  /**
+   * Configuration struct for libcamera sensors.
+   */
+  struct libcamera_config_t {
+    //! The index of camera enumerated by libcamera
+    unsigned cam_index = 0;
+    //! If non-zero, frames are converted and downscaled to this size
+    //! straight from the capture buffer, e.g. the model input size
+    size_t output_width = 0;
+    //! See output_width
+    size_t output_height = 0;
+    //! Minimum interval between full resolution previews when downscaling
+    unsigned preview_interval_ms = 500;
+  };
+
   /**
    * The base class for all temperature sensors.
    *
@@ -78,9 +94,41 @@ namespace rpi_rt {
       /**
        * Sets the callback for gathered camera image frames.
        *
+       * Frames may view the sensor's capture buffers without a copy. A buffer
+       * is only reused once every copy of its frame is gone, so consumers
+       * should not hold on to frames longer than they need.
+       *
        * Adhere to the Interface Segregation Principle (ISP) in SOLID.
        */
       virtual void set_frame_callback(std::function<void (uint64_t frame_id, Frame<uint8_t>)> callback) = 0;
+
+      /**
+       * Sets the callback for full resolution preview frames.
+       *
+       * Only sensors that deliver downscaled frames to the frame callback
+       * produce previews, at a lower rate and off the inference path.
+       *
+       * @return false if the sensor has no separate preview, in which case
+       *         the frame callback already gets full resolution frames.
+       */
+      virtual bool set_preview_callback(std::function<void (uint64_t frame_id, Frame<uint8_t>)> callback) {
+        (void)callback;
+        return false;
+      }
+
+      /**
+       * Requests the next capture at full resolution, e.g. for the alarm
+       * attachment of a downscaled frame that scored as fire.
+       *
+       * Safe to call from any thread while the sensor runs.
+       *
+       * @return an invalid future if the frame callback already gets full
+       *         resolution frames, or the sensor is closed. The future is
+       *         broken if the sensor closes before the capture.
+       */
+      virtual std::shared_future<Frame<uint8_t>> capture_full_resolution() {
+        return {};
+      }
   };
 
   /**
@@ -113,11 +161,11 @@ namespace rpi_rt {
   /**
    * The factory method for creating a camera_sensor_t from libcamera.
    *
-   * @param cam_index The index of camera enumerated by libcamera
+   * @param cfg The camera index and output size
    *
    * Adhere to the Interface Segregation Principle (ISP) in SOLID.
    */
-  std::shared_ptr<camera_sensor_t> create_libcamera_sensor(unsigned cam_index);
+  std::shared_ptr<camera_sensor_t> create_libcamera_sensor(const libcamera_config_t& cfg);
 
 /** @}*/
 
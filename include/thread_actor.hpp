@@ -1,13 +1,17 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <functional>
 #include <thread>
+#include <vector>
 
+#include "alarm.hpp"
 #include "detection_result.hpp"
 #include "logic.hpp"
 #include "sensor.hpp"
 #include "http_server.hpp"
+#include "mailbox.hpp"
 
 namespace rpi_rt {
 
@@ -15,34 +19,113 @@ namespace rpi_rt {
  *  @{
  */
 
+  /**
+   * Counters of the stage between a sensor and its logic.
+   */
+  struct pipeline_stats_t {
+    //! Frames delivered by the sensor
+    uint64_t captured = 0;
+    //! Frames replaced by a newer one before the logic got to them
+    uint64_t dropped = 0;
+  };
+
 /// @cond PRIVATE_DETAILS
 
   namespace detail {
-    void sensor_logic_setup_impl(
-      std::shared_ptr<camera_sensor_t> s,
+    /**
+     * Runs the visual logic on its own thread, always on the newest frames.
+     *
+     * Capture never waits for inference: frames arriving while the logic is
+     * busy replace the waiting one of the same camera and only the last one
+     * is processed. Waiting frames of all cameras go through the model as
+     * one batch.
+     */
+    class inference_stage_t {
+      public:
+        inference_stage_t(
+          std::shared_ptr<visual_classify_logic_t> l,
+          std::shared_ptr<http_server_t> webui,
+          size_t cameras
+        ) : mailbox_(cameras), thread_([this, l, webui](){
+          while (true) {
+            auto frames = mailbox_.wait_all();
+            if (frames.empty())
+              break;
+            for (const auto& f : frames) {
+              latency_assessment::report_timepoint(f.frame_id, latency_assessment::trace_stage_t::dequeued);
+            }
+            l->process_batch(frames);
+            if (webui) {
+              webui->set_logit(l->last_logit());
+            }
+          }
+        }) {}
+
+        inference_stage_t(const inference_stage_t&) = delete;
+        inference_stage_t& operator=(const inference_stage_t&) = delete;
+
+        void post(camera_frame_t frame) {
+          unsigned slot = frame.camera_id;
+          mailbox_.post(std::move(frame), slot);
+        }
+
+        void close() {
+          mailbox_.close();
+          thread_.join();
+        }
+
+        pipeline_stats_t stats() const {
+          return pipeline_stats_t{mailbox_.posted(), mailbox_.dropped()};
+        }
+
+      private:
+        LatestMailbox<camera_frame_t> mailbox_;
+        std::thread thread_;
+    };
+
+    std::unique_ptr<inference_stage_t> sensor_logic_setup_impl(
+      const std::vector<std::shared_ptr<camera_sensor_t>>& sensors,
       std::shared_ptr<visual_classify_logic_t> l,
       std::shared_ptr<http_server_t> webui
     ) {
-      s->set_frame_callback([l, webui](uint64_t frame_id, rpi_rt::Frame<uint8_t> frame) {
-        if (webui) {
-          webui->set_cam_frame(frame);
-        }
-        l->process(frame_id, frame);
-        if (webui) {
-          webui->set_logit(l->last_logit());
-        }
-      });
+      auto stage = std::make_unique<inference_stage_t>(l, webui, sensors.size());
+
+      for (unsigned camera_id = 0; camera_id < sensors.size(); camera_id++) {
+        const auto& s = sensors[camera_id];
+
+        // the WebUI shows the first camera; downscaling sensors send it full
+        // resolution previews instead
+        auto cam_webui = camera_id == 0 ? webui : nullptr;
+        bool preview = cam_webui && s->set_preview_callback(
+            [cam_webui](uint64_t, rpi_rt::Frame<uint8_t> frame) {
+          cam_webui->set_cam_frame(std::move(frame));
+        });
+        s->set_frame_callback([stage = stage.get(), sensor = s.get(), cam_webui, preview, camera_id](
+              uint64_t frame_id, rpi_rt::Frame<uint8_t> frame) {
+          if (cam_webui && !preview) {
+            cam_webui->set_cam_frame(frame);
+          }
+          latency_assessment::report_timepoint(frame_id, latency_assessment::trace_stage_t::queued);
+          stage->post(camera_frame_t{camera_id, frame_id, std::move(frame),
+              [sensor](){ return sensor->capture_full_resolution(); }});
+        });
+      }
+      return stage;
     }
 
-    void sensor_logic_setup_impl(
-      std::shared_ptr<temperature_sensor_t> s,
+    std::unique_ptr<inference_stage_t> sensor_logic_setup_impl(
+      const std::vector<std::shared_ptr<temperature_sensor_t>>& sensors,
       std::shared_ptr<temperature_threshold_logic_t> l,
       std::shared_ptr<http_server_t> webui
     ) {
       (void) webui; // TODO report this too maybe?
-      s->set_celsius_reciever([l](uint64_t frame_id, float celsius) {
-        l->process(frame_id, celsius);
-      });
+      for (const auto& s : sensors) {
+        s->set_celsius_reciever([l](uint64_t frame_id, float celsius) {
+          l->process(frame_id, celsius);
+        });
+      }
+      // cheap enough to run right in the sensor callback
+      return nullptr;
     }
   }
 
@@ -75,6 +158,13 @@ namespace rpi_rt {
        * Stops the thread and wait for its join.
        */
       virtual void close() = 0;
+
+      /**
+       * Frame counters, all zero for sensors without a pipeline stage.
+       */
+      virtual pipeline_stats_t stats() const {
+        return {};
+      }
   };
 
   /**
@@ -94,25 +184,47 @@ namespace rpi_rt {
        * Starts the thread.
        */
       void run() {
-        detail::sensor_logic_setup_impl(sensor_, logic_, http_server_);
-        thread_ = std::thread([sensor = sensor_](){
-          sensor->run();
-        });
+        stage_ = detail::sensor_logic_setup_impl(sensors_, logic_, http_server_);
+        for (const auto& sensor : sensors_) {
+          threads_.emplace_back([sensor](){
+            sensor->run();
+          });
+        }
       }
 
       /**
        * Stops the thread and wait for its join.
        */
       void close() {
-        sensor_->close();
-        thread_.join();
+        for (const auto& sensor : sensors_) {
+          sensor->close();
+        }
+        for (auto& thread : threads_) {
+          thread.join();
+        }
+        if (stage_) {
+          stage_->close();
+        }
+      }
+
+      virtual pipeline_stats_t stats() const override {
+        return stage_ ? stage_->stats() : pipeline_stats_t{};
       }
 
       /**
        * Sets the sensor.
        */
       void set_sensor(std::shared_ptr<Sensor> sensor) {
-        sensor_ = sensor;
+        sensors_ = {sensor};
+      }
+
+      /**
+       * Adds another sensor feeding the same logic, each on its own thread.
+       *
+       * Camera ids in detection results follow the order sensors are added.
+       */
+      void add_sensor(std::shared_ptr<Sensor> sensor) {
+        sensors_.push_back(sensor);
       }
 
       /**
@@ -140,14 +252,25 @@ namespace rpi_rt {
       }
 
     private:
-      std::shared_ptr<Sensor> sensor_;
+      std::vector<std::shared_ptr<Sensor>> sensors_;
       std::shared_ptr<Logic> logic_;
-      std::thread thread_;
+      std::vector<std::thread> threads_;
+
+      // nullptr if the logic runs in the sensor callback
+      std::unique_ptr<detail::inference_stage_t> stage_;
 
       // nullptr if no webui
       std::shared_ptr<http_server_t> http_server_;
   };
 
+  /**
+   * Fans each detection result out to the alarms, each running on its own
+   * thread.
+   *
+   * Reporting only queues the result with every alarm, which never blocks,
+   * so a slow alarm, like email waiting on a TLS handshake, cannot delay
+   * another one, like the buzzer. The alarms share one read only result.
+   */
   class alarm_thread_t {
     public:
       alarm_thread_t() {};
@@ -157,44 +280,85 @@ namespace rpi_rt {
       alarm_thread_t& operator=(alarm_thread_t&&) = delete;
 
       /**
-       * Starts the thread.
+       * Starts a thread per alarm.
        */
       void run() {
-        thread_ = std::thread([alarm = alarm_](){
-          alarm->run();
-        });
+        for (const auto& alarm : alarms_) {
+          threads_.emplace_back([alarm](){
+            alarm->run();
+          });
+        }
       }
 
       /**
-       * Sets the alarm.
+       * Sets the alarm, replacing any added before.
        */
       void set_alarm(std::shared_ptr<alarm_t> alarm) {
-        alarm_ = alarm;
+        alarms_ = {alarm};
       }
 
       /**
-       * Stops the thread and wait for its join.
+       * Adds another alarm receiving every result.
+       */
+      void add_alarm(std::shared_ptr<alarm_t> alarm) {
+        alarms_.push_back(alarm);
+      }
+
+      /**
+       * The number of alarms.
+       */
+      size_t size() const noexcept {
+        return alarms_.size();
+      }
+
+      /**
+       * Stops the threads and wait for their join.
        */
       void close() {
-        alarm_->close();
-        thread_.join();
+        for (const auto& alarm : alarms_) {
+          alarm->close();
+        }
+        for (auto& thread : threads_) {
+          thread.join();
+        }
+        threads_.clear();
       }
 
       /**
-       * Reports a detection result.
+       * Reports a detection result to every alarm.
        *
-       * Wakes up the run function to perform the actual alarming. Subclasses
-       * might have custom throttle implemented.
+       * Wakes up their run functions to perform the actual alarming.
+       * Subclasses might have custom throttle implemented.
        *
        * @param result The outcome reported by sensor and detection logic.
        */
-      void report(std::unique_ptr<detection_result_t> result) {
-        alarm_->report(std::move(result));
+      void report(std::shared_ptr<detection_result_t> result) {
+        latency_assessment::report_timepoint(result->frame_id(), latency_assessment::trace_stage_t::dispatched);
+        reported_.fetch_add(1, std::memory_order_relaxed);
+        for (const auto& alarm : alarms_) {
+          alarm->report(result);
+        }
+      }
+
+      /**
+       * The results reported here, each counted once however many alarms
+       * get it, and those coalesced or dropped summed over the alarms.
+       */
+      alarm_stats_t stats() const {
+        alarm_stats_t total;
+        total.reported = reported_.load(std::memory_order_relaxed);
+        for (const auto& alarm : alarms_) {
+          auto s = alarm->stats();
+          total.coalesced += s.coalesced;
+          total.dropped += s.dropped;
+        }
+        return total;
       }
 
     private:
-      std::shared_ptr<alarm_t> alarm_;
-      std::thread thread_;
+      std::vector<std::shared_ptr<alarm_t>> alarms_;
+      std::vector<std::thread> threads_;
+      std::atomic<uint64_t> reported_{0};
   };
 
 /** @}*/
@@ -1,15 +1,17 @@
 #include <chrono>
 #include <condition_variable>
 #include <functional>
+#include <iomanip>
 #include <memory>
 #include <mutex>
+#include <sstream>
 #include <thread>
 #include <iostream>
-#include <atomic>
 
 #include "alarm.hpp"
 #include "detection_result.hpp"
 #include "frame.hpp"
+#include "mailbox.hpp"
 
 #define CPPHTTPLIB_OPENSSL_SUPPORT
 #pragma GCC diagnostic push
@@ -19,123 +21,222 @@
 #include "third_party/json.hpp"
 #include "third_party/base64.hpp"
 
+#include <openssl/ssl.h>
+
 namespace rpi_rt {
-  bool brevo_send_email(const brevo_config_t& cfg, rpi_rt::detection_result_t& result) {
-    if (!result.has_fire())
-      return false;
-
-    httplib::SSLClient cli(cfg.api_host);
-    httplib::Headers headers = {
-        {"accept", "application/json"},
-        {"api-key", cfg.api_key},
-        {"content-type", "application/json"}
-    };
+  namespace {
+    std::string brevo_email_body(const brevo_config_t& cfg, detection_result_t& result) {
+      std::ostringstream title_oss;
+      auto t = std::time(nullptr);
+      auto tm = *std::localtime(&t);
+      title_oss << "FlameIris Detection Warning Triggered At " << std::put_time(&tm, "%d-%m-%Y %H-%M-%S");
+
+      std::ostringstream html_oss;
+      html_oss << "<html><head></head><body><h1>" << title_oss.str()
+        << "</h1><h3>Details:</h3><p>" << result.explain() << "</p></body></html>";
+
+      nlohmann::json j;
+      j["sender"] = {
+        {"name", cfg.sender_name },
+        {"email", cfg.sender_email }
+      };
+      j["to"] = nlohmann::json::array();
+      j["to"].push_back({
+        {"name", cfg.to_name },
+        {"email", cfg.to_email }
+      });
+      j["subject"] = title_oss.str();
+      j["htmlContent"] = html_oss.str();
+
+      auto jpg_attachment = result.jpg_attachment();
+      if (jpg_attachment && jpg_attachment->size()) {
+        j["attachment"] = nlohmann::json::array();
+        j["attachment"].push_back({
+          {"name", "attach.jpg"},
+          {"content", base64::encode_into<std::string>(
+              jpg_attachment->begin(),
+              jpg_attachment->end())}
+        });
+      }
+      return j.dump();
+    }
 
-    std::ostringstream title_oss; 
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
-    title_oss << "FlameIris Detection Warning Triggered At " << std::put_time(&tm, "%d-%m-%Y %H-%M-%S");
+    /**
+     * One keep-alive connection to the Brevo API host.
+     *
+     * A request reuses the open connection; once the server closed it, the
+     * next one reconnects and resumes the last TLS session, skipping the
+     * certificate exchange. Only used from the alarm thread.
+     */
+    class brevo_client_t {
+      public:
+        explicit brevo_client_t(const brevo_config_t& cfg) : cfg_(cfg) {
+          if (cfg_.api_tls) {
+            auto cli = std::make_unique<httplib::SSLClient>(cfg_.api_host, cfg_.api_port);
+            if (!cfg_.ca_cert_path.empty()) {
+              cli->set_ca_cert_path(cfg_.ca_cert_path);
+            }
+            resume_sessions(static_cast<SSL_CTX*>(cli->tls_context()));
+            cli_ = std::move(cli);
+          } else {
+            cli_ = std::make_unique<httplib::ClientImpl>(cfg_.api_host, cfg_.api_port);
+          }
+          cli_->set_keep_alive(true);
+          cli_->set_connection_timeout(std::chrono::seconds{10});
+          cli_->set_read_timeout(std::chrono::seconds{30});
+        }
+
+        ~brevo_client_t() {
+          if (session_) {
+            SSL_SESSION_free(session_);
+          }
+        }
 
-    std::ostringstream html_oss;
-    html_oss << "<html><head></head><body><h1>" << title_oss.str()
-      << "</h1><h3>Details:</h3><p>" << result.explain() << "</p></body></html>";
+        brevo_client_t(const brevo_client_t&) = delete;
+        brevo_client_t& operator=(const brevo_client_t&) = delete;
+
+        /**
+         * Connects ahead of the first email, checking the API key on the way.
+         */
+        void warm_up() {
+          auto res = cli_->Get("/v3/account", headers());
+          if (!res) {
+            std::cerr << "Brevo API warm up failed: HTTP: " << httplib::to_string(res.error()) << std::endl;
+          } else if (res->status != httplib::OK_200) {
+            std::cerr << "Brevo API warm up: Status: " << res->status
+              << " Body: " << res->body << std::endl;
+          }
+        }
 
-    nlohmann::json j;
-    j["sender"] = {
-      {"name", cfg.sender_name },
-      {"email", cfg.sender_email }
-    };
-    j["to"] = nlohmann::json::array();
-    j["to"].push_back({
-      {"name", cfg.to_name },
-      {"email", cfg.to_email }
-    });
-    j["subject"] = title_oss.str();
-    j["htmlContent"] = html_oss.str();
-
-    auto jpg_attachment = result.jpg_attachment();
-    if (jpg_attachment.size()) {
-      j["attachment"] = nlohmann::json::array();
-      j["attachment"].push_back({
-        {"name", "attach.jpg"},
-        {"content", base64::encode_into<std::string>(
-            jpg_attachment.begin(),
-            jpg_attachment.end())}
-      });
-    }
+        /**
+         * Posts one email.
+         *
+         * @return the HTTP status, 0 if the request did not get through.
+         */
+        int send(const std::string& body) {
+          auto res = cli_->Post(cfg_.api_path, headers(), body, "application/json");
+          if (!res) {
+            // It might be a design flaw of httplib it doesn't use error_category or polymorphism here
+            // We'll have to play by it however.
+            std::cerr << "Brevo API invoke failed: HTTP: " << httplib::to_string(res.error())
+              << " SSL: " << res.ssl_error()
+              << " SSL Backend: " << res.ssl_backend_error() << std::endl;
+            return 0;
+          }
 
-    auto res = cli.Post("/v3/smtp/email", headers, j.dump(), "application/json");
-    if (!res) {
-      // It might be a design flaw of httplib it doesn't use error_category or polymorphism here
-      // We'll have to play by it however.
-      std::cerr << "Brevo API invoke failed: HTTP: " << httplib::to_string(res.error())
-        << " SSL: " << res.ssl_error()
-        << " SSL Backend: " << res.ssl_backend_error() << std::endl;
-      return false;
-    }
+          std::cout << "Brevo API Invoke: Status: " << res->status
+            << " Body: " << res->body << std::endl;
+          return res->status;
+        }
 
-    std::cout << "Brevo API Invoke: Status: " << res->status
-      << " Body: " << res->body << std::endl;
-    return res->status == httplib::OK_200;
+      private:
+        httplib::Headers headers() const {
+          return {
+            {"accept", "application/json"},
+            {"api-key", cfg_.api_key}
+          };
+        }
+
+        // OpenSSL clients never resume on their own: keep the newest session
+        // the server handed out and set it on the next handshake
+        void resume_sessions(SSL_CTX* ctx) {
+          SSL_CTX_set_app_data(ctx, this);
+          SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+          SSL_CTX_sess_set_new_cb(ctx, [](SSL* ssl, SSL_SESSION* session) {
+            auto* self = static_cast<brevo_client_t*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+            if (self->session_) {
+              SSL_SESSION_free(self->session_);
+            }
+            self->session_ = session;
+            return 1;
+          });
+          SSL_CTX_set_info_callback(ctx, [](const SSL* ssl, int where, int) {
+            auto* self = static_cast<brevo_client_t*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+            if ((where & SSL_CB_HANDSHAKE_START) && self->session_) {
+              SSL_set_session(const_cast<SSL*>(ssl), self->session_);
+            }
+          });
+        }
+
+        brevo_config_t cfg_;
+        std::unique_ptr<httplib::ClientImpl> cli_;
+        SSL_SESSION* session_ = nullptr;
+    };
   }
 
   class brevo_email_alarm_t : public alarm_t {
     public:
       brevo_email_alarm_t(brevo_config_t cfg)
-        : cfg_(std::move(cfg)) {}
+        : cfg_(std::move(cfg)), client_(cfg_) {}
       virtual ~brevo_email_alarm_t() override {}
 
       virtual void run() override {
-        while (!closing_) {
-          std::unique_lock lg{mut_result_};
-          while(!closing_) {
-            cond_result_.wait_for(lg, std::chrono::milliseconds{500});
-            if (result_) {
-              latency_assessment::report_timepoint(result_->frame_id(), true);
-              if (result_->has_fire()) {
-                if (last_send_) {
-                  auto now = std::chrono::steady_clock::now();
-                  auto dur = now - *last_send_;
-                  if (dur > std::chrono::hours{2}) {
-                    (void)brevo_send_email(cfg_, *result_);
-                    last_send_ = std::chrono::steady_clock::now();
-                  }
-                } else {
-                  (void)brevo_send_email(cfg_, *result_);
-                  last_send_ = std::chrono::steady_clock::now();
-                }
-              }
-              result_ = nullptr;
-            }
+        // the handshake is done before the first fire, not during it
+        client_.warm_up();
+
+        // fire results arriving while sending coalesce into the newest
+        while (auto result = mailbox_.wait()) {
+          latency_assessment::report_timepoint((*result)->frame_id(), latency_assessment::trace_stage_t::alarm);
+          if (!(*result)->has_fire())
+            continue;
+          auto now = std::chrono::steady_clock::now();
+          if (last_send_ && now - *last_send_ < cfg_.cooldown)
+            continue;
+          // a failed email leaves the cooldown alone, the next fire tries again
+          if (send(brevo_email_body(cfg_, **result))) {
+            last_send_ = std::chrono::steady_clock::now();
           }
         }
       }
 
       virtual void close() override {
-        closing_ = true;
-      }
-
-      virtual void report(std::unique_ptr<detection_result_t> result) override {
         {
-          std::unique_lock lg{mut_result_};
-          result_ = std::move(result);
+          std::unique_lock lg{mut_closing_};
+          closing_ = true;
         }
-        cond_result_.notify_one();
+        cond_closing_.notify_all();
+        mailbox_.close();
+      }
+
+      virtual void report(std::shared_ptr<detection_result_t> result) override {
+        bool fire = result->has_fire();
+        mailbox_.post(std::move(result), fire);
+      }
+
+      virtual alarm_stats_t stats() const override {
+        return alarm_stats_t{mailbox_.posted(), mailbox_.coalesced(), mailbox_.dropped()};
       }
 
     private:
-      std::atomic<bool> closing_ = ATOMIC_VAR_INIT(false);
-      std::unique_ptr<detection_result_t> result_;
-      std::mutex mut_result_;
-      std::condition_variable cond_result_;
+      // retries transport errors, rate limits and server errors with
+      // exponential backoff, cut short by close()
+      bool send(const std::string& body) {
+        auto backoff = cfg_.retry_backoff;
+        for (unsigned attempt = 0; ; attempt++) {
+          int status = client_.send(body);
+          if (status >= 200 && status < 300)
+            return true;
+          bool transient = status == 0 || status == httplib::TooManyRequests_429 || status >= 500;
+          if (!transient || attempt == cfg_.retries)
+            return false;
+
+          std::unique_lock lg{mut_closing_};
+          if (cond_closing_.wait_for(lg, backoff, [this]{ return closing_; }))
+            return false;
+          backoff *= 2;
+        }
+      }
+
+      AlarmMailbox<std::shared_ptr<detection_result_t>> mailbox_{16, true};
       std::optional<std::chrono::steady_clock::time_point> last_send_ = std::nullopt;
       brevo_config_t cfg_;
+      brevo_client_t client_;
+      std::mutex mut_closing_;
+      std::condition_variable cond_closing_;
+      bool closing_ = false;
   };
 
   std::shared_ptr<alarm_t> create_brevo_email_alarm(brevo_config_t cfg) {
     return std::make_shared<brevo_email_alarm_t>(std::move(cfg));
   }
 }
-
-
-
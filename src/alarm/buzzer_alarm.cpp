@@ -1,70 +1,184 @@
 #include <chrono>
-#include <condition_variable>
 #include <functional>
 #include <memory>
-#include <mutex>
-#include <thread>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
 #include <iostream>
-#include <atomic>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
 
 #include "alarm.hpp"
 #include "detection_result.hpp"
 #include "buzzer.h"
 #include "frame.hpp"
+#include "mailbox.hpp"
 
 namespace rpi_rt {
+  namespace {
+    class fd_t {
+      public:
+        explicit fd_t(int fd, const char* what) : fd_(fd) {
+          if (fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), what);
+        }
+        ~fd_t() {
+          ::close(fd_);
+        }
+        fd_t(const fd_t&) = delete;
+        fd_t& operator=(const fd_t&) = delete;
+
+        int get() const noexcept {
+          return fd_;
+        }
+
+      private:
+        int fd_;
+    };
+  }
+
+  /**
+   * Sounds the buzzer in a repeated on/off pattern from an event loop.
+   *
+   * The loop waits on an eventfd for reports and a timerfd for the next
+   * pattern step, so the buzzer is never slept on and a detection is
+   * handled within milliseconds, even mid-beep. Every fire result extends
+   * the alarm to hold past it; the pattern finishes the cycle it is in
+   * once that has passed.
+   */
   class buzzer_alarm_t : public alarm_t {
     public:
       virtual ~buzzer_alarm_t() override {}
-      explicit buzzer_alarm_t(int pin) : buzzer_(pin){}
+      buzzer_alarm_t(buzzer_config_t cfg, std::function<void (bool)> set_buzzer)
+        : cfg_(std::move(cfg)), set_buzzer_(std::move(set_buzzer)),
+          wakeup_(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK), "buzzer: eventfd"),
+          timer_(::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK), "buzzer: timerfd") {
+        if (cfg_.pattern.empty() || cfg_.pattern.size() % 2) {
+          throw std::runtime_error("buzzer: the pattern needs pairs of on and off durations");
+        }
+        for (auto d : cfg_.pattern) {
+          if (d.count() <= 0)
+            throw std::runtime_error("buzzer: pattern durations must be positive");
+        }
+      }
 
       virtual void run() override {
-        while (!closing_) {
-          std::unique_lock lg{mut_result_};
-          while(!closing_) {
-            cond_result_.wait_for(lg, std::chrono::milliseconds{500});
-            if (result_) {
-              latency_assessment::report_timepoint(result_->frame_id(), true);
-              if (result_->has_fire()) {
-                std::cout << "FIRE DETECTED" << std::endl;
-
-                lg.unlock();
-                buzzer_.turnOn();
-                std::this_thread::sleep_for(std::chrono::seconds(2));
-                buzzer_.turnOff();
-                lg.lock();
-              }
-              result_ = nullptr;
+        pollfd fds[2] = {
+          {wakeup_.get(), POLLIN, 0},
+          {timer_.get(), POLLIN, 0}
+        };
+        while (true) {
+          if (::poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+              continue;
+            throw std::system_error(errno, std::generic_category(), "buzzer: poll");
+          }
+          uint64_t count;
+          if (fds[0].revents & POLLIN) {
+            (void)!::read(wakeup_.get(), &count, sizeof(count));
+            if (!drain()) {
+              break;
             }
           }
+          if (fds[1].revents & POLLIN) {
+            (void)!::read(timer_.get(), &count, sizeof(count));
+            advance();
+          }
         }
+        set_buzzer_(false);
       }
 
       virtual void close() override {
-        closing_ = true;
+        mailbox_.close();
+        wake();
       }
 
-      virtual void report(std::unique_ptr<detection_result_t> result) override {
-        {
-          std::unique_lock lg{mut_result_};
-          result_ = std::move(result);
-        }
-        cond_result_.notify_one();
+      virtual void report(std::shared_ptr<detection_result_t> result) override {
+        bool fire = result->has_fire();
+        mailbox_.post(std::move(result), fire);
+        wake();
+      }
+
+      virtual alarm_stats_t stats() const override {
+        return alarm_stats_t{mailbox_.posted(), mailbox_.coalesced(), mailbox_.dropped()};
       }
 
     private:
-      std::atomic<bool> closing_ = ATOMIC_VAR_INIT(false);
-      std::unique_ptr<detection_result_t> result_;
-      std::mutex mut_result_;
-      std::condition_variable cond_result_;
+      void wake() {
+        uint64_t one = 1;
+        (void)!::write(wakeup_.get(), &one, sizeof(one));
+      }
 
-      Buzzer buzzer_;
-  };
+      // handles the waiting results, false once closed
+      bool drain() {
+        while (auto result = mailbox_.wait_for(std::chrono::milliseconds{0})) {
+          latency_assessment::report_timepoint((*result)->frame_id(), latency_assessment::trace_stage_t::alarm);
+          if (!(*result)->has_fire())
+            continue;
+          until_ = std::chrono::steady_clock::now() + cfg_.hold;
+          if (!step_) {
+            std::cout << "FIRE DETECTED" << std::endl;
+            enter(0);
+          }
+        }
+        // a close() wakes us up with nothing left to take
+        return !mailbox_.closed();
+      }
 
-  std::shared_ptr<alarm_t> create_buzzer_alarm(int pin) {
-    return std::make_shared<buzzer_alarm_t>(pin);
-  }
-}
+      void advance() {
+        if (!step_)
+          return;
+        size_t next = *step_ + 1;
+        if (next == cfg_.pattern.size()) {
+          // the last step is silent already
+          if (std::chrono::steady_clock::now() >= until_) {
+            step_.reset();
+            return;
+          }
+          next = 0;
+        }
+        enter(next);
+      }
 
+      // even steps sound, odd ones are silent
+      void enter(size_t step) {
+        step_ = step;
+        set_buzzer_(step % 2 == 0);
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(cfg_.pattern[step]).count();
+        itimerspec spec{};
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+        if (::timerfd_settime(timer_.get(), 0, &spec, nullptr) != 0)
+          throw std::system_error(errno, std::generic_category(), "buzzer: timerfd_settime");
+      }
+
+      buzzer_config_t cfg_;
+      AlarmMailbox<std::shared_ptr<detection_result_t>> mailbox_{16, true};
+
+      std::function<void (bool)> set_buzzer_;
+      fd_t wakeup_;
+      fd_t timer_;
+      // the pattern step sounding, std::nullopt while quiet
+      std::optional<size_t> step_;
+      std::chrono::steady_clock::time_point until_;
+  };
 
+  std::shared_ptr<alarm_t> create_buzzer_alarm(buzzer_config_t cfg) {
+    auto buzzer = std::make_shared<Buzzer>(cfg.pin);
+    return create_buzzer_alarm(std::move(cfg), [buzzer](bool on) {
+      if (on) {
+        buzzer->turnOn();
+      } else {
+        buzzer->turnOff();
+      }
+    });
+  }
 
+  std::shared_ptr<alarm_t> create_buzzer_alarm(buzzer_config_t cfg,
+      std::function<void (bool on)> set_buzzer) {
+    return std::make_shared<buzzer_alarm_t>(std::move(cfg), std::move(set_buzzer));
+  }
+}
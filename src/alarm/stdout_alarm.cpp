@@ -1,15 +1,13 @@
 #include <chrono>
-#include <condition_variable>
 #include <functional>
 #include <memory>
-#include <mutex>
 #include <thread>
 #include <iostream>
-#include <atomic>
 
 #include "alarm.hpp"
 #include "detection_result.hpp"
 #include "frame.hpp"
+#include "mailbox.hpp"
 
 namespace rpi_rt {
   class stdout_alarm_t : public alarm_t {
@@ -17,39 +15,31 @@ namespace rpi_rt {
       virtual ~stdout_alarm_t() override {}
 
       virtual void run() override {
-        while (!closing_) {
-          std::unique_lock lg{mut_result_};
-          while(!closing_) {
-            cond_result_.wait_for(lg, std::chrono::milliseconds{500});
-            if (result_) {
-              latency_assessment::report_timepoint(result_->frame_id(), true);
-              std::cout << result_->explain() << std::endl;
-              if (result_->has_fire()) {
-                std::cout << "FIRE DETECTED" << std::endl;
-              }
-              result_ = nullptr;
-            }
+        // every result is printed, nothing to coalesce
+        while (auto result = mailbox_.wait()) {
+          latency_assessment::report_timepoint((*result)->frame_id(), latency_assessment::trace_stage_t::alarm);
+          std::cout << (*result)->explain() << std::endl;
+          if ((*result)->has_fire()) {
+            std::cout << "FIRE DETECTED" << std::endl;
           }
         }
       }
 
       virtual void close() override {
-        closing_ = true;
+        mailbox_.close();
       }
 
-      virtual void report(std::unique_ptr<detection_result_t> result) override {
-        {
-          std::unique_lock lg{mut_result_};
-          result_ = std::move(result);
-        }
-        cond_result_.notify_one();
+      virtual void report(std::shared_ptr<detection_result_t> result) override {
+        bool fire = result->has_fire();
+        mailbox_.post(std::move(result), fire);
+      }
+
+      virtual alarm_stats_t stats() const override {
+        return alarm_stats_t{mailbox_.posted(), mailbox_.coalesced(), mailbox_.dropped()};
       }
 
     private:
-      std::atomic<bool> closing_ = ATOMIC_VAR_INIT(false);
-      std::unique_ptr<detection_result_t> result_;
-      std::mutex mut_result_;
-      std::condition_variable cond_result_;
+      AlarmMailbox<std::shared_ptr<detection_result_t>> mailbox_;
   };
 
   std::shared_ptr<alarm_t> create_stdout_alarm() {
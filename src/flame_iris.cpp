@@ -7,12 +7,15 @@
 
 #include "third_party/argparse.hpp"
 
+#include <algorithm>
 #include <cerrno>
+#include <filesystem>
 #include <sstream>
 #include <stdexcept>
 #include <system_error>
 #include <thread>
 #include <iostream>
+#include <vector>
 #include <unistd.h>
 #include <signal.h>
 #include <sys/signalfd.h>
@@ -28,11 +31,81 @@ auto make_brevo_config(const argparse::ArgumentParser& program) {
   cfg.sender_email = program.get<std::string>("--brevo-sender-email");
   cfg.to_name = program.get<std::string>("--brevo-to-name");
   cfg.to_email = program.get<std::string>("--brevo-to-email");
+  cfg.cooldown = std::chrono::seconds{program.get<int>("--brevo-cooldown")};
   return cfg;
 }
 
-auto make_vision_logic(const argparse::ArgumentParser& program) {
-  auto model = rpi_rt::create_shufflenet_model();
+auto make_buzzer_config(const argparse::ArgumentParser& program) {
+  rpi_rt::buzzer_config_t cfg;
+  cfg.pin = program.get<int>("--buzzer");
+  cfg.pattern.clear();
+  std::istringstream iss{program.get<std::string>("--buzzer-pattern")};
+  std::string ms;
+  while (std::getline(iss, ms, ',')) {
+    cfg.pattern.emplace_back(std::stoi(ms));
+  }
+  cfg.hold = std::chrono::milliseconds{program.get<int>("--buzzer-hold")};
+  return cfg;
+}
+
+auto make_shufflenet_config(const argparse::ArgumentParser& program) {
+  rpi_rt::shufflenet_config_t cfg;
+  int threads = program.get<int>("--inference-threads");
+  if (threads < 0) {
+    throw std::runtime_error("--inference-threads must not be negative");
+  }
+  cfg.inference_threads = threads;
+  if (program.get<std::string>("--model-precision") == "fp16") {
+    cfg.precision = rpi_rt::shufflenet_precision_t::fp16;
+  } else if (program.get<std::string>("--model-precision") == "qs8") {
+    cfg.precision = rpi_rt::shufflenet_precision_t::qs8;
+  }
+  if (program.present("--profile-model")) {
+    cfg.profile_path = program.get<std::string>("--profile-model");
+  }
+  return cfg;
+}
+
+auto make_shufflenet_model(const argparse::ArgumentParser& program, size_t cameras) {
+  auto cfg = make_shufflenet_config(program);
+  cfg.batch_size = cameras;
+  if (program.get<std::string>("--model-backend") == "subgraph") {
+    return rpi_rt::create_shufflenet_subgraph_model(std::move(cfg));
+  }
+  return rpi_rt::create_shufflenet_model(std::move(cfg));
+}
+
+void calibrate_model(const argparse::ArgumentParser& program) {
+  if (!program.present("--model")) {
+    throw std::runtime_error("--calibrate requires --model");
+  }
+
+  std::vector<std::string> jpeg_files;
+  for (const auto& entry : std::filesystem::directory_iterator(
+        program.get<std::string>("--calibrate"))) {
+    auto ext = entry.path().extension();
+    if (entry.is_regular_file() && (ext == ".jpg" || ext == ".jpeg")) {
+      jpeg_files.push_back(entry.path().string());
+    }
+  }
+  std::sort(jpeg_files.begin(), jpeg_files.end());
+
+  std::cout << "Calibrating with " << jpeg_files.size() << " images .." << std::endl;
+  rpi_rt::calibrate_shufflenet_model(program.get<std::string>("--model"), jpeg_files);
+  std::cout << "Calibration written to " << program.get<std::string>("--model") << std::endl;
+}
+
+void pack_model(const argparse::ArgumentParser& program) {
+  if (!program.present("--model")) {
+    throw std::runtime_error("--pack-model requires --model");
+  }
+  rpi_rt::pack_shufflenet_model(program.get<std::string>("--model"),
+      program.get<std::string>("--pack-model"));
+  std::cout << "Model packed into " << program.get<std::string>("--pack-model") << std::endl;
+}
+
+auto make_vision_logic(const argparse::ArgumentParser& program, size_t cameras) {
+  auto model = make_shufflenet_model(program, cameras);
   model->setup(program.get<std::string>("--model"));
   auto logic = std::make_shared<rpi_rt::visual_classify_logic_t>();
   logic->logit_threshold(program.get<float>("--logit-threshold"));
@@ -43,13 +116,36 @@ auto make_vision_logic(const argparse::ArgumentParser& program) {
   return logic;
 }
 
+// every --libcamera, --v4l2 and --mock-cam given, in that order
+auto make_camera_sensors(const argparse::ArgumentParser& program) {
+  std::vector<std::shared_ptr<rpi_rt::camera_sensor_t>> sensors;
+  for (int index : program.get<std::vector<int>>("--libcamera")) {
+    rpi_rt::libcamera_config_t cfg;
+    cfg.cam_index = index;
+    if (program.get<bool>("--camera-downscale")) {
+      cfg.output_width = 224;
+      cfg.output_height = 224;
+    }
+    sensors.push_back(rpi_rt::create_libcamera_sensor(cfg));
+  }
+  for (const auto& device : program.get<std::vector<std::string>>("--v4l2")) {
+    sensors.push_back(rpi_rt::create_v4l2_camera_sensor(device));
+  }
+  for (const auto& filename : program.get<std::vector<std::string>>("--mock-cam")) {
+    sensors.push_back(rpi_rt::create_mock_camera_sensor(filename));
+  }
+  return sensors;
+}
+
 auto make_vision_thread(
-    std::shared_ptr<rpi_rt::camera_sensor_t> sensor,
+    const std::vector<std::shared_ptr<rpi_rt::camera_sensor_t>>& sensors,
     std::shared_ptr<rpi_rt::visual_classify_logic_t> logic) {
   auto v_thread = std::make_unique<
     rpi_rt::SensorLogicThread<
     rpi_rt::camera_sensor_t, rpi_rt::visual_classify_logic_t>>();
-  v_thread->set_sensor(sensor);
+  for (const auto& sensor : sensors) {
+    v_thread->add_sensor(sensor);
+  }
   v_thread->set_logic(logic);
   if (webui) {
     v_thread->set_http_server(webui);
@@ -59,22 +155,11 @@ auto make_vision_thread(
 
 auto make_sensor_logic_thread(const argparse::ArgumentParser& program) {
   std::unique_ptr<rpi_rt::sensor_logic_thread_t> thread;
-  if (program.present("--model") && program.present<int>("--libcamera")) {
-    auto sensor = rpi_rt::create_libcamera_sensor(
-        program.get<int>("--libcamera"));
-    auto logic = make_vision_logic(program);
-    thread = make_vision_thread(sensor, logic);
-  } else if (program.present("--model") && program.present("--v4l2")) {
-    auto sensor = rpi_rt::create_v4l2_camera_sensor(
-        program.get<std::string>("--v4l2"));
-    auto logic = make_vision_logic(program);
-    thread = make_vision_thread(sensor, logic);
-  } else if (program.present("--model") && program.present("--mock-cam")) {
-    auto sensor = rpi_rt::create_mock_camera_sensor(
-        program.get<std::string>("--mock-cam"));
-    auto logic = make_vision_logic(program);
-    thread = make_vision_thread(sensor, logic);
-} else if (program.present<int>("--ntc-adc")) {
+  auto cameras = make_camera_sensors(program);
+  if (program.present("--model") && !cameras.empty()) {
+    auto logic = make_vision_logic(program, cameras.size());
+    thread = make_vision_thread(cameras, logic);
+  } else if (program.present<int>("--ntc-adc")) {
     rpi_rt::breadpi_ntc_config_t cfg;
     cfg.adc_channel = program.get<int>("--ntc-adc");
     cfg.beta = program.get<float>("--ntc-beta");
@@ -94,7 +179,6 @@ auto make_sensor_logic_thread(const argparse::ArgumentParser& program) {
     t_thread->set_sensor(sensor);
     t_thread->set_logic(logic);
     thread = std::move(t_thread);
-} else if (program.get<bool>("--mock-temp")) {
   } else if (program.get<bool>("--mock-temp")) {
     auto sensor = rpi_rt::create_mock_temperature_sensor();
     auto logic = std::make_shared<rpi_rt::temperature_threshold_logic_t>();
@@ -113,17 +197,18 @@ auto make_sensor_logic_thread(const argparse::ArgumentParser& program) {
 
 auto make_alarm_thread(const argparse::ArgumentParser& program) {
   auto thread = std::make_unique<rpi_rt::alarm_thread_t>();
+  // every alarm given runs, each on its own thread
+  if (program.get<bool>("--alarm-stdout")) {
+    thread->add_alarm(rpi_rt::create_stdout_alarm());
+  }
+  if (program.present<int>("--buzzer")) {
+    thread->add_alarm(rpi_rt::create_buzzer_alarm(make_buzzer_config(program)));
+  }
   if (program.present("--brevo-api-key")) {
     auto cfg = make_brevo_config(program);
-    auto alarm = rpi_rt::create_brevo_email_alarm(std::move(cfg));
-    thread->set_alarm(alarm);
-  } else if (program.get<bool>("--alarm-stdout")) {
-    auto alarm = rpi_rt::create_stdout_alarm();
-    thread->set_alarm(alarm);
-  } else if (program.present<int>("--buzzer")) {
-    auto alarm = rpi_rt::create_buzzer_alarm(program.get<int>("--buzzer"));
-    thread->set_alarm(alarm);
-  } else {
+    thread->add_alarm(rpi_rt::create_brevo_email_alarm(std::move(cfg)));
+  }
+  if (!thread->size()) {
     throw std::runtime_error("No valid alarm specified");
   }
   return thread;
@@ -139,14 +224,38 @@ int main(int argc, char** argv) {
 
   argparse::ArgumentParser program("flame_iris");
   program.add_argument("--libcamera")
-    .help("libcamera camera index (e.g. 0)")
+    .help("libcamera camera index (e.g. 0), repeat for more cameras")
+    .append()
     .scan<'i', int>();
+  program.add_argument("--camera-downscale")
+    .help("Have libcamera deliver model-sized frames, full resolution only for the WebUI and alarm attachments")
+    .flag();
   program.add_argument("--v4l2")
-    .help("Path to v4l2 camera device (e.g. /dev/video0)");
+    .help("Path to v4l2 camera device (e.g. /dev/video0), repeat for more cameras")
+    .append();
   program.add_argument("--mock-cam")
-    .help("Use ffmpeg to loop a video as mock camera sensor");
+    .help("Use ffmpeg to loop a video as mock camera sensor, repeat for more cameras")
+    .append();
   program.add_argument("--model")
-    .help("Path to shufflenet model dir (e.g. testdata/model)");
+    .help("Path to shufflenet model dir (e.g. testdata/model) or packed model file");
+  program.add_argument("--model-backend")
+    .help("Run the model as individual XNNPACK operators or one subgraph")
+    .default_value("operators")
+    .choices("operators", "subgraph");
+  program.add_argument("--model-precision")
+    .help("Model precision; fp16 and qs8 need the subgraph backend, qs8 also a calibration")
+    .default_value("fp32")
+    .choices("fp32", "fp16", "qs8");
+  program.add_argument("--calibrate")
+    .help("Record qs8 calibration for --model from a folder of JPEGs, then exit");
+  program.add_argument("--pack-model")
+    .help("Pack the --model dir into this single, memory mapped model file, then exit");
+  program.add_argument("--inference-threads")
+    .help("Threads used for model inference, 0 for one per core")
+    .default_value(0)
+    .scan<'i', int>();
+  program.add_argument("--profile-model")
+    .help("Time every model operator, print a table and write a Chrome trace to this file on exit; operators backend only");
   program.add_argument("--mock-temp")
     .flag()
     .help("Use mocked temperature sensor");
@@ -159,6 +268,13 @@ int main(int argc, char** argv) {
   program.add_argument("--buzzer")
     .help("GPIO buzzer pin")
     .scan<'i', int>();
+  program.add_argument("--buzzer-pattern")
+    .help("Buzzer on and off durations in ms, repeated while fire persists (e.g. 500,250)")
+    .default_value("500,250");
+  program.add_argument("--buzzer-hold")
+    .help("Keep the buzzer pattern going this many ms after the last fire frame")
+    .default_value(2000)
+    .scan<'i', int>();
   program.add_argument("--temp-threshold")
     .help("Temperature threshold in celsius degree")
     .default_value(200.0f)
@@ -196,6 +312,10 @@ int main(int argc, char** argv) {
     .help("Brevo email alarming receiver name");
   program.add_argument("--brevo-to-email")
     .help("Brevo email alarming receiver email");
+  program.add_argument("--brevo-cooldown")
+    .help("Least seconds between two alarm emails")
+    .default_value(7200)
+    .scan<'i', int>();
 
   // breadpi ntc
   program.add_argument("--ntc-adc")
@@ -229,13 +349,26 @@ int main(int argc, char** argv) {
     .help("The voltage value of Vref");
 
   program.add_argument("--assess-latency")
-    .help("Generate latency report")
+    .help("Record a binary latency trace, decode it with contrib/process_latency.py")
     .flag();
+  program.add_argument("--latency-trace")
+    .default_value(std::string("latency.trace"))
+    .help("The file --assess-latency writes to");
 
   program.parse_args(argc, argv);
 
+  if (program.present("--calibrate")) {
+    calibrate_model(program);
+    return 0;
+  }
+
+  if (program.present("--pack-model")) {
+    pack_model(program);
+    return 0;
+  }
+
   if (program.get<bool>("--assess-latency"))
-    rpi_rt::latency_assessment::begin_assessment();
+    rpi_rt::latency_assessment::begin_assessment(program.get<std::string>("--latency-trace"));
 
   if (program.present("--webui-path")) {
     webui = rpi_rt::create_http_server();
@@ -285,11 +418,32 @@ int main(int argc, char** argv) {
   sensor_logic_thread->close();
   alarm_thread->close();
 
+  auto stats = sensor_logic_thread->stats();
+  if (stats.captured) {
+    std::cout << "Frames captured: " << stats.captured
+      << " dropped: " << stats.dropped << std::endl;
+  }
+  auto alarm_stats = alarm_thread->stats();
+  if (alarm_stats.reported) {
+    std::cout << "Results reported: " << alarm_stats.reported
+      << " coalesced: " << alarm_stats.coalesced
+      << " dropped: " << alarm_stats.dropped << std::endl;
+  }
+
   if (webui) {
     webui->close();
     webui_thread.join();
   }
 
+  if (program.get<bool>("--assess-latency")) {
+    auto dropped = rpi_rt::latency_assessment::end_assessment();
+    std::cout << "Latency trace written to " << program.get<std::string>("--latency-trace");
+    if (dropped) {
+      std::cout << ", " << dropped << " records dropped";
+    }
+    std::cout << std::endl;
+  }
+
   std::cout << "Bye!" << std::endl;
   return 0;
 }
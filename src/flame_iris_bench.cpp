@@ -0,0 +1,196 @@
+#include "frame.hpp"
+#include "logic.hpp"
+
+#include "third_party/argparse.hpp"
+#include "third_party/json.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Runs the ShuffleNet model in a tight loop, without sensors, alarms or
+// their sleeps, and reports latency percentiles and throughput.
+
+namespace {
+  // the same noise every run, so results are comparable
+  rpi_rt::Frame<uint8_t> synthetic_frame(size_t height, size_t width, uint32_t seed) {
+    rpi_rt::Frame<uint8_t> frame{height, width, 3};
+    uint32_t state = seed;
+    for (size_t i = 0; i < frame.size(); i++) {
+      state = state * 1664525u + 1013904223u;
+      frame.data()[i] = static_cast<uint8_t>(state >> 24);
+    }
+    return frame;
+  }
+
+  double percentile(const std::vector<double>& sorted, double p) {
+    size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+  }
+
+  auto make_config(const argparse::ArgumentParser& program) {
+    rpi_rt::shufflenet_config_t cfg;
+    int threads = program.get<int>("--threads");
+    int batch = program.get<int>("--batch");
+    if (threads < 0) {
+      throw std::runtime_error("--threads must not be negative");
+    }
+    if (batch < 1) {
+      throw std::runtime_error("--batch must be at least 1");
+    }
+    cfg.inference_threads = threads;
+    cfg.batch_size = batch;
+    if (program.get<std::string>("--model-precision") == "fp16") {
+      cfg.precision = rpi_rt::shufflenet_precision_t::fp16;
+    } else if (program.get<std::string>("--model-precision") == "qs8") {
+      cfg.precision = rpi_rt::shufflenet_precision_t::qs8;
+    }
+    return cfg;
+  }
+}
+
+int main(int argc, char **argv) {
+  argparse::ArgumentParser program("flame_iris_bench");
+
+  program.add_argument("--model")
+    .help("Path to shufflenet model dir or packed model file")
+    .default_value(std::string("testdata/model"));
+  program.add_argument("--model-backend")
+    .help("Run the model as individual XNNPACK operators or one subgraph")
+    .default_value("operators")
+    .choices("operators", "subgraph");
+  program.add_argument("--model-precision")
+    .help("Model precision; fp16 and qs8 need the subgraph backend, qs8 also a calibration")
+    .default_value("fp32")
+    .choices("fp32", "fp16", "qs8");
+  program.add_argument("--threads")
+    .help("Threads used for model inference, 0 for one per core")
+    .default_value(0)
+    .scan<'i', int>();
+  program.add_argument("--batch")
+    .help("Frames per forward pass, as with that many cameras")
+    .default_value(1)
+    .scan<'i', int>();
+  program.add_argument("--warmup")
+    .help("Untimed iterations before measuring")
+    .default_value(10)
+    .scan<'i', int>();
+  program.add_argument("--iterations")
+    .help("Timed iterations")
+    .default_value(200)
+    .scan<'i', int>();
+  program.add_argument("--width")
+    .help("Width of the synthetic input frames")
+    .default_value(640)
+    .scan<'i', int>();
+  program.add_argument("--height")
+    .help("Height of the synthetic input frames")
+    .default_value(480)
+    .scan<'i', int>();
+  program.add_argument("--jpeg")
+    .help("Feed this image instead of synthetic frames, --width and --height are ignored");
+  program.add_argument("--json")
+    .help("Also write the results as JSON to this file, - for stdout");
+
+  program.parse_args(argc, argv);
+
+  int warmup = program.get<int>("--warmup");
+  int iterations = program.get<int>("--iterations");
+  int width = program.get<int>("--width");
+  int height = program.get<int>("--height");
+  if (warmup < 0 || iterations < 1) {
+    throw std::runtime_error("--warmup must not be negative and --iterations at least 1");
+  }
+  if (width < 1 || height < 1) {
+    throw std::runtime_error("--width and --height must be at least 1");
+  }
+
+  auto cfg = make_config(program);
+  size_t batch = cfg.batch_size;
+  size_t threads = cfg.inference_threads;
+  auto model = program.get<std::string>("--model-backend") == "subgraph"
+    ? rpi_rt::create_shufflenet_subgraph_model(std::move(cfg))
+    : rpi_rt::create_shufflenet_model(std::move(cfg));
+  model->setup(program.get<std::string>("--model"));
+
+  std::vector<rpi_rt::Frame<uint8_t>> frames;
+  std::string input = "synthetic";
+  if (program.present("--jpeg")) {
+    input = program.get<std::string>("--jpeg");
+    auto frame = rpi_rt::jpeg_utils::read_from_file(input);
+    frames.assign(batch, frame);
+  } else {
+    for (size_t i = 0; i < batch; i++) {
+      frames.push_back(synthetic_frame(height, width, i + 1));
+    }
+  }
+
+  for (int i = 0; i < warmup; i++) {
+    model->process_batch(frames);
+  }
+
+  std::vector<double> latencies_ms;
+  latencies_ms.reserve(iterations);
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    model->process_batch(frames);
+    auto end = std::chrono::steady_clock::now();
+    latencies_ms.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  double total_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  std::sort(latencies_ms.begin(), latencies_ms.end());
+  double mean = std::accumulate(latencies_ms.begin(), latencies_ms.end(), 0.0) / latencies_ms.size();
+
+  nlohmann::json j;
+  j["backend"] = program.get<std::string>("--model-backend");
+  j["precision"] = program.get<std::string>("--model-precision");
+  j["threads"] = threads;
+  j["batch"] = batch;
+  j["input"] = input;
+  j["width"] = frames.front().width();
+  j["height"] = frames.front().height();
+  j["warmup"] = warmup;
+  j["iterations"] = iterations;
+  j["latency_ms"] = {
+    {"mean", mean},
+    {"min", latencies_ms.front()},
+    {"p50", percentile(latencies_ms, 50)},
+    {"p90", percentile(latencies_ms, 90)},
+    {"p99", percentile(latencies_ms, 99)},
+    {"max", latencies_ms.back()},
+  };
+  j["throughput_fps"] = iterations * batch / total_s;
+
+  std::cerr << j["backend"].get<std::string>() << " " << j["precision"].get<std::string>()
+    << ", batch " << batch << ", " << frames.front().width() << "x" << frames.front().height()
+    << " " << input << "\n"
+    << "latency (ms): mean " << mean
+    << " p50 " << j["latency_ms"]["p50"].get<double>()
+    << " p90 " << j["latency_ms"]["p90"].get<double>()
+    << " p99 " << j["latency_ms"]["p99"].get<double>()
+    << " max " << latencies_ms.back() << "\n"
+    << "throughput: " << j["throughput_fps"].get<double>() << " frames/s" << std::endl;
+
+  if (program.present("--json")) {
+    auto path = program.get<std::string>("--json");
+    if (path == "-") {
+      std::cout << j.dump(2) << std::endl;
+    } else {
+      std::ofstream ofs{path};
+      ofs << j.dump(2) << std::endl;
+      if (!ofs) {
+        throw std::runtime_error("failed to write " + path);
+      }
+    }
+  }
+
+  return 0;
+}
@@ -1,60 +1,262 @@
 #include <chrono>
+#include <filesystem>
 #include <functional>
 #include <memory>
 #include <stdexcept>
 #include <fstream>
+#include <iostream>
 #include <iterator>
 
 #include "logic.hpp"
 
 #include "shufflenet/preprocess.hpp"
 #include "shufflenet/model.hpp"
+#include "shufflenet/subgraph_model.hpp"
+#include "shufflenet/calibration.hpp"
+#include "shufflenet/profiler.hpp"
+#include "shufflenet/model_file.hpp"
+#include "shufflenet/weights_cache.hpp"
 
 namespace rpi_rt {
+  namespace {
+    void read_param_file(const std::string& path, float* data, size_t size) {
+      std::ifstream ifs{path, std::ios::binary};
+      ifs.unsetf(std::ios::skipws);
+      ifs.seekg(0, std::ios::end);
+      auto fsize = ifs.tellg() / sizeof(float);
+      if (fsize != size)
+        throw std::runtime_error(std::string("shufflenet: ") + path + " : param file size mismatch");
+      ifs.seekg(0, std::ios::beg);
+      ifs.read((char *)data, size * sizeof(float));
+    }
+
+    std::unique_ptr<logic::shufflenet::ModelFile> load_params(const std::string& model_path,
+        logic::shufflenet::Model<float>::Params& params) {
+      params.resize({4, 8, 4}, {24, 48, 96, 192, 64});
+      if (!std::filesystem::is_directory(model_path)) {
+        // a packed model file, the params view its mapping
+        auto file = std::make_unique<logic::shufflenet::ModelFile>(model_path);
+        params.bind([&file](const std::string& name, size_t size) {
+          return file->tensor(name, size);
+        });
+        return file;
+      }
+      params.load([&model_path](const std::string& name, float* data, size_t size){
+          read_param_file(model_path + "/" + name, data, size);
+      });
+      return nullptr;
+    }
+
+    std::string weights_cache_path(const std::string& model_path) {
+      return model_path + ".xnncache";
+    }
+
+    // operators created in this scope pack their weights into cache
+    class weights_cache_scope_t {
+      public:
+        explicit weights_cache_scope_t(logic::shufflenet::WeightsCache* cache) {
+          if (cache) {
+            logic::shufflenet::XNNPackGuard::instance().weights_cache(cache->provider());
+          }
+        }
+
+        ~weights_cache_scope_t() {
+          logic::shufflenet::XNNPackGuard::instance().weights_cache(nullptr);
+        }
+    };
+
+    std::string calibration_path(const std::string& model_path) {
+      if (!std::filesystem::is_directory(model_path)) {
+        return model_path + ".calibration";
+      }
+      return model_path + "/calibration";
+    }
+  }
+
+  /**
+   * Wraps a network backend (Model or SubgraphModel) with preprocessing
+   * and parameter loading.
+   */
+  template <class Network>
   class shufflenet_model_t : public visual_classfying_model_t {
     public:
-      virtual ~shufflenet_model_t() override {}
+      explicit shufflenet_model_t(shufflenet_config_t cfg)
+        : cfg_(std::move(cfg)) {}
+
+      virtual ~shufflenet_model_t() override {
+        if (cfg_.profile_path.empty())
+          return;
+        std::ofstream ofs{cfg_.profile_path};
+        profiler_.write_chrome_trace(ofs);
+        profiler_.print_table(std::cout);
+        std::cout << "Operator profile written to " << cfg_.profile_path << std::endl;
+      }
 
       virtual void setup(const std::string& model_path) override {
-        prep_buffer_.resize(224, 224, 3);
-        output_buffer_.resize(1, 1, 1);
-        model_params_.resize({4, 8, 4}, {24, 48, 96, 192, 64});
-        model_params_.load([&model_path](const std::string& name, float* data, size_t size){
-            read_param_file(model_path + "/" + name, data, size);
-        });
+        if (cfg_.batch_size == 0) {
+          throw std::runtime_error("shufflenet: batch size must be at least 1");
+        }
+        // the first model sizes the shared threadpool, a later one must ask
+        // for the same count while the first is alive
+        logic::shufflenet::XNNPackGuard::instance().threads(cfg_.inference_threads);
+
+        prep_buffer_.resize(cfg_.batch_size, 224, 224, 3);
+        output_buffer_.resize(cfg_.batch_size, 1, 1, 1);
+        model_file_ = load_params(model_path, model_params_);
+
+        if constexpr (std::is_same_v<typename Network::elem_t, int8_t>) {
+          std::ifstream ifs{calibration_path(model_path)};
+          if (!ifs) {
+            throw std::runtime_error("shufflenet: " + calibration_path(model_path)
+                + " missing, calibrate the model first");
+          }
+          calibration_.load(ifs);
+          model_.calibration(calibration_);
+        }
+
+        if constexpr (std::is_same_v<Network, logic::shufflenet::Model<float>>) {
+          if (!cfg_.profile_path.empty()) {
+            model_.profile(profiler_);
+          }
+        }
+
+        // packed weights persist for packed model files, whose tensors keep
+        // their offsets across runs
+        if (model_file_) {
+          weights_cache_ = std::make_unique<logic::shufflenet::WeightsCache>();
+          weights_cache_->load(weights_cache_path(model_path), *model_file_);
+        }
 
         prep_.setup(prep_buffer_);
-        model_.setup(prep_buffer_, output_buffer_, model_params_);
+        {
+          weights_cache_scope_t scope{weights_cache_.get()};
+          model_.setup(prep_buffer_, output_buffer_, model_params_);
+        }
+
+        if (weights_cache_) {
+          std::cout << "shufflenet: " << weights_cache_->hits() << " weights from the cache, "
+            << weights_cache_->misses() << " packed" << std::endl;
+          try {
+            weights_cache_->save(weights_cache_path(model_path));
+          } catch (const std::exception& e) {
+            // only costs the next start its repacking
+            std::cerr << e.what() << std::endl;
+          }
+        }
+
+        if constexpr (std::is_same_v<Network, logic::shufflenet::Model<float>>) {
+          std::cout << "shufflenet: activations take " << model_.activation_bytes()
+            << " bytes, " << model_.unplanned_activation_bytes() << " without reuse" << std::endl;
+        }
       }
 
       virtual float process(const Frame<uint8_t>& frame) override {
         prep_.process(frame);
+        latency_assessment::report_timepoint(latency_assessment::trace_stage_t::preprocessed);
         model_.forward();
         return output_buffer_.data()[0];
       }
 
-    private:
-      static void read_param_file(const std::string& path, float* data, size_t size) {
-        std::ifstream ifs{path, std::ios::binary};
-        ifs.unsetf(std::ios::skipws);
-        ifs.seekg(0, std::ios::end);
-        auto fsize = ifs.tellg() / sizeof(float);
-        if (fsize != size)
-          throw std::runtime_error(std::string("shufflenet: ") + path + " : param file size mismatch");
-        ifs.seekg(0, std::ios::beg);
-        ifs.read((char *)data, size * sizeof(float));
+      // batch slots without a frame keep their last image, the model always
+      // runs the full batch it was set up with
+      virtual std::vector<float> process_batch(const std::vector<Frame<uint8_t>>& frames) override {
+        if (frames.size() > cfg_.batch_size) {
+          throw std::runtime_error("shufflenet: more frames than the batch size");
+        }
+        for (size_t i = 0; i < frames.size(); i++) {
+          prep_.process(frames[i], i);
+        }
+        latency_assessment::report_timepoint(latency_assessment::trace_stage_t::preprocessed);
+        model_.forward();
+        return {output_buffer_.data(), output_buffer_.data() + frames.size()};
       }
 
+    private:
+      shufflenet_config_t cfg_;
       logic::shufflenet::Preprocess prep_;
       Frame<float> prep_buffer_;
-      logic::shufflenet::Model<float>::Params model_params_;
-      logic::shufflenet::Model<float> model_;
+      std::unique_ptr<logic::shufflenet::ModelFile> model_file_;
+      std::unique_ptr<logic::shufflenet::WeightsCache> weights_cache_;
+      typename Network::Params model_params_;
+      logic::shufflenet::Calibration calibration_;
+      logic::shufflenet::Profiler profiler_;
+      Network model_;
       Frame<float> output_buffer_;
   };
 
-  std::shared_ptr<visual_classfying_model_t> create_shufflenet_model() {
-    return std::make_shared<shufflenet_model_t>();
+  std::shared_ptr<visual_classfying_model_t> create_shufflenet_model(shufflenet_config_t cfg) {
+    if (cfg.precision != shufflenet_precision_t::fp32) {
+      throw std::runtime_error("shufflenet: the operator backend only runs fp32");
+    }
+    return std::make_shared<shufflenet_model_t<
+      logic::shufflenet::Model<float>>>(std::move(cfg));
   }
-}
 
+  std::shared_ptr<visual_classfying_model_t> create_shufflenet_subgraph_model(shufflenet_config_t cfg) {
+    if (!cfg.profile_path.empty()) {
+      // one fused runtime, no operators to time
+      throw std::runtime_error("shufflenet: only the operator backend can be profiled");
+    }
+    switch (cfg.precision) {
+      case shufflenet_precision_t::fp16:
+        return std::make_shared<shufflenet_model_t<
+          logic::shufflenet::SubgraphModel<logic::shufflenet::Float16>>>(std::move(cfg));
+      case shufflenet_precision_t::qs8:
+        return std::make_shared<shufflenet_model_t<
+          logic::shufflenet::SubgraphModel<int8_t>>>(std::move(cfg));
+      case shufflenet_precision_t::fp32:
+      default:
+        return std::make_shared<shufflenet_model_t<
+          logic::shufflenet::SubgraphModel<float>>>(std::move(cfg));
+    }
+  }
+
+  void calibrate_shufflenet_model(const std::string& model_path,
+      const std::vector<std::string>& jpeg_files) {
+    if (jpeg_files.empty()) {
+      throw std::runtime_error("shufflenet: no images to calibrate with");
+    }
+
+    logic::shufflenet::Model<float>::Params params;
+    auto model_file = load_params(model_path, params);
+
+    Frame<float> prep_buffer{224, 224, 3};
+    Frame<float> output_buffer{1, 1, 1};
+    logic::shufflenet::Preprocess prep;
+    prep.setup(prep_buffer);
 
+    logic::shufflenet::Calibration calibration;
+    logic::shufflenet::SubgraphModel<float> model;
+    model.observe(calibration);
+    model.setup(prep_buffer, output_buffer, params);
+
+    for (const auto& file : jpeg_files) {
+      prep.process(jpeg_utils::read_from_file(file));
+      model.forward();
+    }
+
+    std::ofstream ofs{calibration_path(model_path)};
+    calibration.save(ofs);
+  }
+
+  void pack_shufflenet_model(const std::string& model_dir, const std::string& file) {
+    logic::shufflenet::Model<float>::Params params;
+    params.resize({4, 8, 4}, {24, 48, 96, 192, 64});
+    std::vector<logic::shufflenet::ModelFile::tensor_t> tensors;
+    params.load([&model_dir, &tensors](const std::string& name, float* data, size_t size){
+        read_param_file(model_dir + "/" + name, data, size);
+        tensors.push_back({name, data, size});
+    });
+
+    // written aside and renamed, so a running deploy never sees half a file
+    std::string tmp = file + ".tmp";
+    {
+      std::ofstream ofs{tmp, std::ios::binary | std::ios::trunc};
+      logic::shufflenet::ModelFile::write(ofs, tensors);
+      if (!ofs.flush()) {
+        throw std::runtime_error("shufflenet: failed to write " + tmp);
+      }
+    }
+    std::filesystem::rename(tmp, file);
+  }
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include <string>
 #include <stdexcept>
 #include <type_traits>
 #include <vector>
@@ -14,6 +15,8 @@
 #include "xnnpack.h"
 #include "xnn_common.hpp"
 #include "frame.hpp"
+#include "profiler.hpp"
+#include "memory_planner.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -73,6 +76,31 @@ public:
       }
     }
 
+    Weights<elem_t>* weights(char type, char index) noexcept {
+      switch (type) {
+        case 'w':
+          switch (index) {
+            case '0':
+              return &first_conv_params_.weights();
+            case '1':
+              return &second_conv_params_.weights();
+            default:
+              return nullptr;
+          }
+        case 'b':
+          switch (index) {
+            case '0':
+              return &first_conv_params_.bias();
+            case '1':
+              return &second_conv_params_.bias();
+            default:
+              return nullptr;
+          }
+        default:
+          return nullptr;
+      }
+    }
+
     size_t size(char type, char index) const noexcept {
       switch (type) {
         case 'w':
@@ -118,22 +146,46 @@ public:
   Branch1& operator=(const Branch1&) = delete;
   Branch1& operator=(Branch1&&) = delete;
 
+  // takes the buffer from planner on setup(), input and output are its ids
+  void plan(MemoryPlanner<elem_t>& planner, size_t input, size_t output, const Params& params) {
+    const auto& out = planner.shape(output);
+    planner_ = &planner;
+    buffer_id_ = planner.request(out.batch, out.height, out.width, params.first_conv_params().channels());
+    planner.use({input, buffer_id_}, planner.schedule());
+    planner.use({buffer_id_, output}, planner.schedule());
+  }
+
   void setup(const Frame<float>& input, Frame<float>& output, const Params& params) {
-    buffer_.resize(output.height(), output.width(), params.first_conv_params().channels());
+    if (planner_) {
+      buffer_ = planner_->frame(buffer_id_);
+    } else {
+      buffer_.resize(output.batch(), output.height(), output.width(), params.first_conv_params().channels());
+    }
 
     first_conv_.setup(input, buffer_, params.first_conv_params());
     second_conv_.setup(buffer_, output, params.second_conv_params());
   }
 
+  // times the operators as NAME.*, call after setup()
+  void profile(Profiler& profiler, const std::string& name) {
+    profiler_ = &profiler;
+    first_op_ = profiler.add(name + ".dwconv", first_conv_.cost());
+    profiler.add(name + ".conv1x1", second_conv_.cost());
+  }
+
   void forward() {
-    first_conv_.forward();
-    second_conv_.forward();
+    profiled(profiler_, first_op_ + 0, [this]{ first_conv_.forward(); });
+    profiled(profiler_, first_op_ + 1, [this]{ second_conv_.forward(); });
   }
 
 private:
   DepthwiseConv2D<elem_t> first_conv_;
   Conv2D<elem_t> second_conv_;
   Frame<elem_t> buffer_;
+  MemoryPlanner<elem_t>* planner_ = nullptr;
+  size_t buffer_id_ = 0;
+  Profiler* profiler_ = nullptr;
+  size_t first_op_ = 0;
 };
 
 }
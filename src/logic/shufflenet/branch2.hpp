@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include <string>
 #include <stdexcept>
 #include <type_traits>
 #include <vector>
@@ -14,6 +15,8 @@
 #include "xnnpack.h"
 #include "xnn_common.hpp"
 #include "frame.hpp"
+#include "profiler.hpp"
+#include "memory_planner.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -82,6 +85,35 @@ public:
       }
     }
 
+    Weights<elem_t>* weights(char type, char index) noexcept {
+      switch (type) {
+        case 'w':
+          switch (index) {
+            case '0':
+              return &first_conv_params_.weights();
+            case '1':
+              return &second_conv_params_.weights();
+            case '2':
+              return &third_conv_params_.weights();
+            default:
+              return nullptr;
+          }
+        case 'b':
+          switch (index) {
+            case '0':
+              return &first_conv_params_.bias();
+            case '1':
+              return &second_conv_params_.bias();
+            case '2':
+              return &third_conv_params_.bias();
+            default:
+              return nullptr;
+          }
+        default:
+          return nullptr;
+      }
+    }
+
     size_t size(char type, char index) const noexcept {
       switch (type) {
         case 'w':
@@ -136,19 +168,47 @@ public:
   Branch2& operator=(const Branch2&) = delete;
   Branch2& operator=(Branch2&&) = delete;
 
-  void setup(const Frame<float>& input, Frame<float>& output, const Params& params) {
-    buffer_one_.resize(input.height(), input.width(), params.first_conv_params().output_feature());
-    buffer_two_.resize(output.height(), output.width(), params.second_conv_params().channels());
+  // takes the buffers from planner on setup(), input and output are its ids
+  void plan(MemoryPlanner<elem_t>& planner, size_t input, size_t output, const Params& params) {
+    const auto& in = planner.shape(input);
+    const auto& out = planner.shape(output);
+    planner_ = &planner;
+    buffer_one_id_ = planner.request(in.batch, in.height, in.width, params.first_conv_params().output_feature());
+    buffer_two_id_ = planner.request(out.batch, out.height, out.width, params.second_conv_params().channels());
+    planner.use({input, buffer_one_id_}, planner.schedule());
+    planner.use({buffer_one_id_, buffer_two_id_}, planner.schedule());
+    planner.use({buffer_two_id_, output}, planner.schedule());
+  }
+
+  // without branch1, input is the whole block input and the second half
+  // of its channels is read in place from input_channel_offset
+  void setup(const Frame<float>& input, Frame<float>& output, const Params& params,
+      size_t input_channel_offset = 0) {
+    if (planner_) {
+      buffer_one_ = planner_->frame(buffer_one_id_);
+      buffer_two_ = planner_->frame(buffer_two_id_);
+    } else {
+      buffer_one_.resize(input.batch(), input.height(), input.width(), params.first_conv_params().output_feature());
+      buffer_two_.resize(output.batch(), output.height(), output.width(), params.second_conv_params().channels());
+    }
 
-    first_conv_.setup(input, buffer_one_, params.first_conv_params());
+    first_conv_.setup(input, buffer_one_, params.first_conv_params(), input_channel_offset);
     second_conv_.setup(buffer_one_, buffer_two_, params.second_conv_params());
     third_conv_.setup(buffer_two_, output, params.third_conv_params());
   }
 
+  // times the operators as NAME.*, call after setup()
+  void profile(Profiler& profiler, const std::string& name) {
+    profiler_ = &profiler;
+    first_op_ = profiler.add(name + ".conv1x1_0", first_conv_.cost());
+    profiler.add(name + ".dwconv", second_conv_.cost());
+    profiler.add(name + ".conv1x1_1", third_conv_.cost());
+  }
+
   void forward() {
-    first_conv_.forward();
-    second_conv_.forward();
-    third_conv_.forward();
+    profiled(profiler_, first_op_ + 0, [this]{ first_conv_.forward(); });
+    profiled(profiler_, first_op_ + 1, [this]{ second_conv_.forward(); });
+    profiled(profiler_, first_op_ + 2, [this]{ third_conv_.forward(); });
   }
 
 private:
@@ -157,6 +217,11 @@ private:
   Conv2D<elem_t> third_conv_;
   Frame<elem_t> buffer_one_;
   Frame<elem_t> buffer_two_;
+  MemoryPlanner<elem_t>* planner_ = nullptr;
+  size_t buffer_one_id_ = 0;
+  size_t buffer_two_id_ = 0;
+  Profiler* profiler_ = nullptr;
+  size_t first_op_ = 0;
 };
 
 }
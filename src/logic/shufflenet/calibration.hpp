@@ -0,0 +1,83 @@
+#pragma once
+
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace rpi_rt::logic::shufflenet {
+
+/**
+ * Activation ranges observed while running the fp32 model, used to derive
+ * the per-tensor scale and zero point of a quantized model.
+ *
+ * Ranges are indexed by the order activations are defined in SubgraphModel,
+ * so a calibration is only valid for the model layout it was recorded with.
+ */
+class Calibration {
+public:
+  struct range_t {
+    float min = 0.0f;
+    float max = 0.0f;
+  };
+
+  Calibration() {}
+
+  size_t size() const noexcept {
+    return ranges_.size();
+  }
+
+  const range_t& range(size_t index) const {
+    return ranges_.at(index);
+  }
+
+  void observe(size_t index, const float* data, size_t size) {
+    if (index >= ranges_.size()) {
+      ranges_.resize(index + 1);
+    }
+    auto [lo, hi] = std::minmax_element(data, data + size);
+    auto& range = ranges_[index];
+    range.min = std::min(range.min, *lo);
+    range.max = std::max(range.max, *hi);
+  }
+
+  void save(std::ostream& os) const {
+    os << std::setprecision(std::numeric_limits<float>::max_digits10);
+    os << magic << " " << version << " " << ranges_.size() << "\n";
+    for (const auto& range : ranges_) {
+      os << range.min << " " << range.max << "\n";
+    }
+    if (!os) {
+      throw std::runtime_error("shufflenet: failed to write calibration");
+    }
+  }
+
+  void load(std::istream& is) {
+    std::string file_magic;
+    int file_version = 0;
+    size_t count = 0;
+    is >> file_magic >> file_version >> count;
+    if (!is || file_magic != magic || file_version != version) {
+      throw std::runtime_error("shufflenet: not a calibration file");
+    }
+    ranges_.resize(count);
+    for (auto& range : ranges_) {
+      is >> range.min >> range.max;
+    }
+    if (!is) {
+      throw std::runtime_error("shufflenet: truncated calibration file");
+    }
+  }
+
+private:
+  static constexpr const char* magic = "shufflenet-calibration";
+  static constexpr int version = 1;
+
+  std::vector<range_t> ranges_;
+};
+
+}
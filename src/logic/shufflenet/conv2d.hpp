@@ -12,16 +12,19 @@
 #include "xnnpack.h"
 #include "xnn_common.hpp"
 #include "frame.hpp"
+#include "profiler.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 /*
 Conv2D operator (2D convolution) backed by XNNPACK.
 
-- Layout: assumes NHWC (N == 1) with compact/contiguous memory (Frame<Elem>).
+- Layout: assumes NHWC with compact/contiguous memory (Frame<Elem>).
 - Data type: fp32 only (Elem must be float).
 - Weights layout: (out_channels, kernel_h, kernel_w, in_channels).
 - Supports: stride, padding, optional bias, and optional fused ReLU
   (implemented via output_min/output_max when creating the XNNPACK operator).
+- The input may have more channels than the weights, then a contiguous
+  range of them is read in place (pixel stride = input channels).
 - Usage pattern:
     1) setup(input, output, params)  -> create/reshape/setup XNNPACK operator
     2) forward()                     -> run the operator
@@ -80,6 +83,10 @@ public:
       return buffer_.data();
     }
 
+    Weights<elem_t>& weights() noexcept {
+      return buffer_;
+    }
+
     void stride_width(size_t stride_width) noexcept {
       stride_width_ = stride_width;
     }
@@ -149,7 +156,7 @@ public:
     size_t kernel_width_ = 0;
     size_t kernel_height_ = 0;
     size_t input_feature_ = 0;
-    std::vector<elem_t> buffer_;
+    Weights<elem_t> buffer_;
 
     size_t stride_width_ = 1;
     size_t stride_height_ = 1;
@@ -163,7 +170,10 @@ public:
 
   Conv2D() {}
   ~Conv2D() {
-    xnn_delete_operator(conv_op_);
+    if (conv_op_) {
+      xnn_delete_operator(conv_op_);
+      XNNPackGuard::instance().release();
+    }
   }
 
   Conv2D(const Conv2D&) = delete;
@@ -171,10 +181,12 @@ public:
   Conv2D& operator=(const Conv2D&) = delete;
   Conv2D& operator=(Conv2D&&) = delete;
 
-  void setup(const Frame<float>& input, Frame<float>& output, const Params& params) {
+  // reads input channels [input_channel_offset, + params.input_feature())
+  void setup(const Frame<float>& input, Frame<float>& output, const Params& params,
+      size_t input_channel_offset = 0) {
     (void)XNNPackGuard::instance();
 
-    assert(input.channels() == params.input_feature());
+    assert(input_channel_offset + params.input_feature() <= input.channels());
     assert(output.channels() == params.output_feature());
 
     xnn_status status;
@@ -188,59 +200,68 @@ public:
         1,
         params.input_feature(),
         params.output_feature(),
-        params.input_feature(),
+        input.channels(),
         params.output_feature(),
         params.data(),
         params.has_bias() ? params.bias().data() : nullptr,
         params.relu() ? 0 : -INFINITY, INFINITY,
         0,
         nullptr,
-        nullptr,
+        XNNPackGuard::instance().weights_cache(),
         &conv_op_);
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_create_convolution2d_nhwc_f32");
     }
+    XNNPackGuard::instance().retain();
 
     size_t workspace_size, workspace_alignment, output_height, output_width;
     status = xnn_reshape_convolution2d_nhwc_f32(
         conv_op_,
-        1,
+        input.batch(),
         input.height(),
         input.width(),
         &workspace_size,
         &workspace_alignment,
         &output_height,
         &output_width,
-        nullptr);
+        XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_reshape_convolution2d_nhwc_f32");
     }
 
+    assert(input.batch() == output.batch());
     assert(output_height == output.height());
     assert(output_width == output.width());
 
     status = xnn_setup_convolution2d_nhwc_f32(
         conv_op_,
         nullptr,
-        input.data(),
+        input.data() + input_channel_offset,
         output.data());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_setup_convolution2d_nhwc_f32");
     }
+
+    cost_.flops = 2 * output.size() * params.kernel_height() * params.kernel_width() * params.input_feature();
+    cost_.bytes = frame_bytes(input) / input.channels() * params.input_feature() + frame_bytes(output)
+      + (params.size() + (params.has_bias() ? params.bias().size() : 0)) * sizeof(elem_t);
   }
 
   void forward() {
-    (void)XNNPackGuard::instance();
-
     xnn_status status;
-    status = xnn_run_operator(conv_op_, nullptr);
+    status = xnn_run_operator(conv_op_, XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_run_operator(convolution2d_nhwc)");
     }
   }
 
+  const OpCost& cost() const noexcept {
+    return cost_;
+  }
+
 private:
   xnn_operator_t conv_op_ = nullptr;
+  OpCost cost_;
 };
 
 }
@@ -12,6 +12,7 @@
 #include "xnnpack.h"
 #include "xnn_common.hpp"
 #include "frame.hpp"
+#include "profiler.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -64,6 +65,10 @@ public:
       return buffer_.data();
     }
 
+    Weights<elem_t>& weights() noexcept {
+      return buffer_;
+    }
+
     void stride_width(size_t stride_width) noexcept {
       stride_width_ = stride_width;
     }
@@ -124,7 +129,7 @@ public:
     size_t channels_ = 0;
     size_t kernel_height_ = 0;
     size_t kernel_width_ = 0;
-    std::vector<elem_t> buffer_;
+    Weights<elem_t> buffer_;
 
     size_t stride_height_ = 1;
     size_t stride_width_ = 1;
@@ -136,7 +141,10 @@ public:
 
   DepthwiseConv2D() {}
   ~DepthwiseConv2D() {
-    xnn_delete_operator(conv_op_);
+    if (conv_op_) {
+      xnn_delete_operator(conv_op_);
+      XNNPackGuard::instance().release();
+    }
   }
 
   DepthwiseConv2D(const DepthwiseConv2D&) = delete;
@@ -168,27 +176,29 @@ public:
         -INFINITY, INFINITY,
         0,
         nullptr,
-        nullptr,
+        XNNPackGuard::instance().weights_cache(),
         &conv_op_);
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_create_convolution2d_nhwc_f32");
     }
+    XNNPackGuard::instance().retain();
 
     size_t workspace_size, workspace_alignment, output_height, output_width;
     status = xnn_reshape_convolution2d_nhwc_f32(
         conv_op_,
-        1,
+        input.batch(),
         input.height(),
         input.width(),
         &workspace_size,
         &workspace_alignment,
         &output_height,
         &output_width,
-        nullptr);
+        XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_reshape_convolution2d_nhwc_f32");
     }
 
+    assert(input.batch() == output.batch());
     assert(output_height == output.height());
     assert(output_width == output.width());
 
@@ -200,20 +210,27 @@ public:
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_setup_convolution2d_nhwc_f32");
     }
+
+    cost_.flops = 2 * output.size() * params.kernel_height() * params.kernel_width();
+    cost_.bytes = frame_bytes(input) + frame_bytes(output)
+      + (params.size() + (params.has_bias() ? params.bias().size() : 0)) * sizeof(elem_t);
   }
 
   void forward() {
-    (void)XNNPackGuard::instance();
-
     xnn_status status;
-    status = xnn_run_operator(conv_op_, nullptr);
+    status = xnn_run_operator(conv_op_, XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_run_operator(convolution2d_nhwc)");
     }
   }
 
+  const OpCost& cost() const noexcept {
+    return cost_;
+  }
+
 private:
   xnn_operator_t conv_op_ = nullptr;
+  OpCost cost_;
 };
 
 }
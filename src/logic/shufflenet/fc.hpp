@@ -12,6 +12,7 @@
 #include "xnnpack.h"
 #include "xnn_common.hpp"
 #include "frame.hpp"
+#include "profiler.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -65,6 +66,10 @@ public:
       return buffer_.data();
     }
 
+    Weights<elem_t>& weights() noexcept {
+      return buffer_;
+    }
+
     void add_bias() {
       if (! bias_.has_value()) {
         bias_.emplace(output_feature_);
@@ -92,14 +97,17 @@ public:
   private:
     size_t output_feature_ = 0;
     size_t input_feature_ = 0;
-    std::vector<elem_t> buffer_;
+    Weights<elem_t> buffer_;
 
     std::optional<Bias<elem_t>> bias_ = std::nullopt;
   };
 
   Fc() {}
   ~Fc() {
-    xnn_delete_operator(fc_op_);
+    if (fc_op_) {
+      xnn_delete_operator(fc_op_);
+      XNNPackGuard::instance().release();
+    }
   }
 
   Fc(const Fc&) = delete;
@@ -116,6 +124,7 @@ public:
     assert(input.width() == 1);
     assert(output.height() == 1);
     assert(output.width() == 1);
+    assert(input.batch() == output.batch());
 
     xnn_status status;
 
@@ -129,16 +138,17 @@ public:
         -INFINITY, INFINITY,
         0,
         nullptr,
-        nullptr,
+        XNNPackGuard::instance().weights_cache(),
         &fc_op_);
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_create_fully_connected_nc_f32");
     }
+    XNNPackGuard::instance().retain();
 
     status = xnn_reshape_fully_connected_nc_f32(
         fc_op_,
-        1,
-        nullptr);
+        input.batch(),
+        XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_reshape_fully_connected_nc_f32");
     }
@@ -150,20 +160,27 @@ public:
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_setup_fully_connected_nc_f32");
     }
+
+    cost_.flops = 2 * output.size() * params.input_feature();
+    cost_.bytes = frame_bytes(input) + frame_bytes(output)
+      + (params.size() + (params.has_bias() ? params.bias().size() : 0)) * sizeof(elem_t);
   }
 
   void forward() {
-    (void)XNNPackGuard::instance();
-
     xnn_status status;
-    status = xnn_run_operator(fc_op_, nullptr);
+    status = xnn_run_operator(fc_op_, XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_run_operator(convolution2d_nhwc)");
     }
   }
 
+  const OpCost& cost() const noexcept {
+    return cost_;
+  }
+
 private:
   xnn_operator_t fc_op_ = nullptr;
+  OpCost cost_;
 };
 
 }
@@ -12,6 +12,7 @@
 #include "xnnpack.h"
 #include "xnn_common.hpp"
 #include "frame.hpp"
+#include "profiler.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -30,7 +31,10 @@ public:
 
   GlobalAveragePool2D() {}
   ~GlobalAveragePool2D() {
-    xnn_delete_operator(pool_op_);
+    if (pool_op_) {
+      xnn_delete_operator(pool_op_);
+      XNNPackGuard::instance().release();
+    }
   }
 
   GlobalAveragePool2D(const GlobalAveragePool2D&) = delete;
@@ -44,6 +48,7 @@ public:
     assert(input.channels() == output.channels());
     assert(output.width() == 1);
     assert(output.height() == 1);
+    assert(input.batch() == output.batch());
 
     xnn_status status;
 
@@ -60,19 +65,20 @@ public:
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_create_reduce_nd");
     }
+    XNNPackGuard::instance().retain();
 
-    size_t shape[] = {input.height(), input.width(), input.channels()};
-    int64_t axes[] = {0, 1};
+    size_t shape[] = {input.batch(), input.height(), input.width(), input.channels()};
+    int64_t axes[] = {1, 2};
     size_t workspace_size, workspace_alignment;
     status = xnn_reshape_reduce_nd(
         pool_op_,
         2,
         axes,
-        3,
+        4,
         shape,
         &workspace_size,
         &workspace_alignment,
-        nullptr);
+        XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_reshape_reduce_nd");
     }
@@ -85,20 +91,26 @@ public:
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_setup_reduce_nd");
     }
+
+    cost_.flops = input.size();
+    cost_.bytes = frame_bytes(input) + frame_bytes(output);
   }
 
   void forward() {
-    (void)XNNPackGuard::instance();
-
     xnn_status status;
-    status = xnn_run_operator(pool_op_, nullptr);
+    status = xnn_run_operator(pool_op_, XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_run_operator(reduce_nd:mean)");
     }
   }
 
+  const OpCost& cost() const noexcept {
+    return cost_;
+  }
+
 private:
   xnn_operator_t pool_op_ = nullptr;
+  OpCost cost_;
 };
 
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include <string>
 #include <stdexcept>
 #include <type_traits>
 #include <vector>
@@ -11,9 +12,10 @@
 
 #include "branch1.hpp"
 #include "branch2.hpp"
-#include "chunk.hpp"
 #include "shuffle.hpp"
 #include "frame.hpp"
+#include "profiler.hpp"
+#include "memory_planner.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -54,6 +56,17 @@ public:
       }
     }
 
+    Weights<elem_t>* weights(char branch, char type, char index) noexcept {
+      switch (branch) {
+        case '1':
+          return branch1_params_->weights(type, index);
+        case '2':
+          return branch2_params_.weights(type, index);
+        default:
+          return nullptr;
+      }
+    }
+
     size_t size(char branch, char type, char index) const noexcept {
       switch (branch) {
         case '1':
@@ -104,31 +117,67 @@ public:
   InvertedResidual& operator=(const InvertedResidual&) = delete;
   InvertedResidual& operator=(InvertedResidual&&) = delete;
 
+  // takes its and the branches' buffers from planner on setup(), input
+  // and output are its ids
+  void plan(MemoryPlanner<elem_t>& planner, size_t input, size_t output, const Params& params) {
+    const auto& out = planner.shape(output);
+    planner_ = &planner;
+    out2_id_ = planner.request(out.batch, out.height, out.width, out.channels / 2);
+    if (params.has_branch1()) {
+      out1_id_ = planner.request(out.batch, out.height, out.width, out.channels / 2);
+      branch1_.emplace();
+      branch1_->plan(planner, input, out1_id_, params.branch1_params());
+      branch2_.plan(planner, input, out2_id_, params.branch2_params());
+      planner.use({out1_id_, out2_id_, output}, planner.schedule());
+    } else {
+      branch1_ = std::nullopt;
+      branch2_.plan(planner, input, out2_id_, params.branch2_params());
+      planner.use({input, out2_id_, output}, planner.schedule());
+    }
+  }
+
   void setup(const Frame<float>& input, Frame<float>& output, const Params& params) {
-    out1_.resize(output.height(), output.width(), output.channels() / 2);
-    out2_.resize(output.height(), output.width(), output.channels() / 2);
+    if (planner_) {
+      out2_ = planner_->frame(out2_id_);
+    } else {
+      out2_.resize(output.batch(), output.height(), output.width(), output.channels() / 2);
+    }
 
     if (params.has_branch1()) {
-      branch1_.emplace();
+      if (planner_) {
+        out1_ = planner_->frame(out1_id_);
+      } else {
+        branch1_.emplace();
+        out1_.resize(output.batch(), output.height(), output.width(), output.channels() / 2);
+      }
       branch1_->setup(input, out1_, params.branch1_params());
       branch2_.setup(input, out2_, params.branch2_params());
+      shuffle_.setup(out1_, out2_, output);
     } else {
+      // no chunk copies: branch2 reads the second half of the input and
+      // the shuffle the first half, both in place
       branch1_ = std::nullopt;
-      in2_.resize(input.height(), input.width(), input.channels() / 2);
-      chunk_.setup(input, out1_, in2_);
-      branch2_.setup(in2_, out2_, params.branch2_params());
+      branch2_.setup(input, out2_, params.branch2_params(), input.channels() / 2);
+      shuffle_.setup(input, out2_, output);
+    }
+  }
+
+  // times the operators as NAME.*, call after setup()
+  void profile(Profiler& profiler, const std::string& name) {
+    profiler_ = &profiler;
+    if (branch1_.has_value()) {
+      branch1_->profile(profiler, name + ".branch1");
     }
-    shuffle_.setup(out1_, out2_, output);
+    branch2_.profile(profiler, name + ".branch2");
+    shuffle_op_ = profiler.add(name + ".shuffle", shuffle_.cost());
   }
 
   void forward() {
     if (branch1_.has_value()) {
       branch1_->forward();
-    } else {
-      chunk_.forward();
     }
     branch2_.forward();
-    shuffle_.forward();
+    profiled(profiler_, shuffle_op_, [this]{ shuffle_.forward(); });
   }
 
 private:
@@ -136,9 +185,12 @@ private:
   Branch2<elem_t> branch2_;
   Frame<elem_t> out1_;
   Frame<elem_t> out2_;
-  Frame<elem_t> in2_;
-  Chunk<elem_t> chunk_;
   Shuffle<elem_t> shuffle_;
+  MemoryPlanner<elem_t>* planner_ = nullptr;
+  size_t out1_id_ = 0;
+  size_t out2_id_ = 0;
+  Profiler* profiler_ = nullptr;
+  size_t shuffle_op_ = 0;
 };
 
 }
@@ -12,6 +12,7 @@
 #include "xnnpack.h"
 #include "xnn_common.hpp"
 #include "frame.hpp"
+#include "profiler.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -19,7 +20,7 @@ namespace rpi_rt::logic::shufflenet {
 MaxPool2D operator (2D max pooling) backed by XNNPACK.
 
 - Purpose: downsample feature maps by taking the maximum value in each pooling window.
-- Layout: assumes NHWC (N == 1) with compact/contiguous memory (Frame<Elem>).
+- Layout: assumes NHWC with compact/contiguous memory (Frame<Elem>).
 - Data type: fp32 only (Elem must be float). (See static_assert in the implementation.)
 - Parameters: input width/height and pooling kernel size (see Params setters).
 - Usage pattern:
@@ -115,7 +116,10 @@ public:
 
   Maxpool2D() {}
   ~Maxpool2D() {
-    xnn_delete_operator(maxpool_op_);
+    if (maxpool_op_) {
+      xnn_delete_operator(maxpool_op_);
+      XNNPackGuard::instance().release();
+    }
   }
 
   Maxpool2D(const Maxpool2D&) = delete;
@@ -142,11 +146,12 @@ public:
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_create_max_pooling2d_nhwc_f32");
     }
+    XNNPackGuard::instance().retain();
 
     size_t output_height, output_width;
     status = xnn_reshape_max_pooling2d_nhwc_f32(
         maxpool_op_,
-        1,
+        input.batch(),
         input.height(),
         input.width(),
         input.channels(),
@@ -154,11 +159,12 @@ public:
         output.channels(),
         &output_height,
         &output_width,
-        nullptr);
+        XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_reshape_max_pooling2d_nhwc_f32");
     }
 
+    assert(input.batch() == output.batch());
     assert(output_height == output.height());
     assert(output_width == output.width());
 
@@ -169,20 +175,27 @@ public:
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_setup_max_pooling2d_nhwc_f32");
     }
+
+    // one compare per window element
+    cost_.flops = output.size() * params.height() * params.width();
+    cost_.bytes = frame_bytes(input) + frame_bytes(output);
   }
 
   void forward() {
-    (void)XNNPackGuard::instance();
-
     xnn_status status;
-    status = xnn_run_operator(maxpool_op_, nullptr);
+    status = xnn_run_operator(maxpool_op_, XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_run_operator(max_pooling2d_nhwc)");
     }
   }
 
+  const OpCost& cost() const noexcept {
+    return cost_;
+  }
+
 private:
   xnn_operator_t maxpool_op_ = nullptr;
+  OpCost cost_;
 };
 
 }
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "frame.hpp"
+
+namespace rpi_rt::logic::shufflenet {
+
+/**
+ * Packs the intermediate activations of the operator backend (Model) into
+ * one aligned arena.
+ *
+ * Operators are scheduled in the order they run; a buffer is live from the
+ * first to the last step that uses it, and two buffers share memory when
+ * their steps don't overlap. An operator's input and output are used at
+ * the same step, so they never alias.
+ *
+ * Offsets are assigned greedy by size: largest buffer first, into the
+ * lowest gap between the live buffers already placed. For a chain like
+ * ShuffleNet that is close to the peak live set.
+ *
+ * Request every buffer, call plan(), then frame() returns views of the
+ * arena; the arena lives as long as the last of them.
+ */
+template <class Elem>
+class MemoryPlanner {
+public:
+  using elem_t = Elem;
+
+  struct shape_t {
+    size_t batch = 1;
+    size_t height = 0;
+    size_t width = 0;
+    size_t channels = 0;
+
+    size_t size() const noexcept {
+      return batch * height * width * channels;
+    }
+  };
+
+  MemoryPlanner() {}
+
+  MemoryPlanner(const MemoryPlanner&) = delete;
+  MemoryPlanner& operator=(const MemoryPlanner&) = delete;
+
+  //! Appends an operator to the schedule, returns its step
+  size_t schedule() noexcept {
+    return steps_++;
+  }
+
+  //! A buffer without steps yet, returns the id to use() and frame() with
+  size_t request(size_t batch, size_t height, size_t width, size_t channels) {
+    assert(!arena_);
+    buffers_.push_back(buffer_t{shape_t{batch, height, width, channels}});
+    return buffers_.size() - 1;
+  }
+
+  //! The buffers are read or written at step
+  void use(std::initializer_list<size_t> buffers, size_t step) {
+    assert(!arena_);
+    for (auto id : buffers) {
+      auto& b = buffers_[id];
+      b.first = std::min(b.first, step);
+      b.last = std::max(b.last, step);
+    }
+  }
+
+  const shape_t& shape(size_t buffer) const noexcept {
+    return buffers_[buffer].shape;
+  }
+
+  //! Assigns the offsets and allocates the arena
+  void plan() {
+    std::vector<size_t> order(buffers_.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+      return bytes(buffers_[a]) > bytes(buffers_[b]);
+    });
+
+    footprint_ = 0;
+    std::vector<const buffer_t*> placed;
+    for (auto id : order) {
+      auto& b = buffers_[id];
+
+      // the live buffers already placed, by offset
+      std::vector<const buffer_t*> live;
+      for (const auto* p : placed) {
+        if (p->first <= b.last && b.first <= p->last) {
+          live.push_back(p);
+        }
+      }
+      std::sort(live.begin(), live.end(), [](const buffer_t* l, const buffer_t* r) {
+        return l->offset < r->offset;
+      });
+
+      size_t offset = 0;
+      for (const auto* p : live) {
+        if (p->offset >= offset + bytes(b)) {
+          break;
+        }
+        offset = std::max(offset, p->offset + bytes(*p));
+      }
+      b.offset = offset;
+      footprint_ = std::max(footprint_, offset + bytes(b));
+      placed.push_back(&b);
+    }
+
+    // XNNPACK may read a few bytes past its input, keep that in the arena
+    arena_ = detail::make_aligned_buffer<uint8_t>(footprint_ + detail::frame_alignment,
+        detail::pooled_frame_alignment);
+  }
+
+  //! A view of the buffer in the arena, after plan()
+  Frame<elem_t> frame(size_t buffer) const {
+    assert(arena_);
+    const auto& b = buffers_[buffer];
+    std::shared_ptr<elem_t> data{arena_, reinterpret_cast<elem_t*>(arena_.get() + b.offset)};
+    return {b.shape.batch, b.shape.height, b.shape.width, b.shape.channels, std::move(data)};
+  }
+
+  //! Bytes of the arena, the peak of the live buffers
+  size_t footprint() const noexcept {
+    return footprint_;
+  }
+
+  //! Bytes the buffers would take without reuse
+  size_t total_bytes() const noexcept {
+    size_t total = 0;
+    for (const auto& b : buffers_) {
+      total += bytes(b);
+    }
+    return total;
+  }
+
+private:
+  struct buffer_t {
+    shape_t shape;
+    size_t first = SIZE_MAX;
+    size_t last = 0;
+    size_t offset = 0;
+  };
+
+  // rounded up so every view stays aligned
+  static size_t bytes(const buffer_t& b) noexcept {
+    size_t n = b.shape.size() * sizeof(elem_t);
+    return (n + detail::frame_alignment - 1) / detail::frame_alignment * detail::frame_alignment;
+  }
+
+  std::vector<buffer_t> buffers_;
+  size_t steps_ = 0;
+  size_t footprint_ = 0;
+  std::shared_ptr<uint8_t> arena_;
+};
+
+}
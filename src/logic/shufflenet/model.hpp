@@ -1,6 +1,7 @@
 #pragma once
 
 #include <functional>
+#include <iterator>
 #include <list>
 #include <optional>
 #include <stdexcept>
@@ -18,6 +19,8 @@
 #include "inverted_residual.hpp"
 #include "frame.hpp"
 #include "fc.hpp"
+#include "profiler.hpp"
+#include "memory_planner.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -34,46 +37,20 @@ public:
       resize(stage_repeats, output_channels);
     }
 
+    // copies every weight in, load_fn fills data with the size elements of name
     void load(std::function<void (const std::string&, elem_t*, size_t)> load_fn) {
-      load_fn("c1w", conv_pre_.data(), conv_pre_.size());
-      load_fn("c1b", conv_pre_.bias().data(), conv_pre_.bias().size());
-      load_fn("c5w", conv_post_.data(), conv_post_.size());
-      load_fn("c5b", conv_post_.bias().data(), conv_post_.bias().size());
-      load_fn("fcw", fc_.data(), fc_.size());
-      load_fn("fcb", fc_.bias().data(), fc_.bias().size());
-
-      int stage_nr = 2;
-      for (auto& stage : stages_) {
-        int repeat_nr = 0;
-        for (auto& repeat : stage) {
-          std::ostringstream oss;
-          oss << "s" << stage_nr << "r" << repeat_nr;
-          std::string prefix = oss.str();
-
-          auto load_repeat_fn = [&prefix, &load_fn, &repeat](const std::string& suffix){
-            load_fn(prefix + "x" + suffix, repeat.data(suffix[0], suffix[1], suffix[2]), repeat.size(suffix[0], suffix[1], suffix[2]));
-          };
-
-          // branch1
-          if (repeat.has_branch1()) {
-            load_repeat_fn("1w0");
-            load_repeat_fn("1b0");
-            load_repeat_fn("1w1");
-            load_repeat_fn("1b1");
-          }
-
-          // branch2
-          load_repeat_fn("2w0");
-          load_repeat_fn("2b0");
-          load_repeat_fn("2w1");
-          load_repeat_fn("2b1");
-          load_repeat_fn("2w2");
-          load_repeat_fn("2b2");
+      for_each_weights([&load_fn](const std::string& name, Weights<elem_t>& weights) {
+        load_fn(name, weights.data(), weights.size());
+      });
+    }
 
-          repeat_nr++;
-        }
-        stage_nr++;
-      }
+    // views every weight in place instead, bind_fn returns the size elements
+    // of name, which must outlive these params and the models set up from
+    // them (e.g. a ModelFile); resize() makes the params own them again
+    void bind(std::function<const elem_t* (const std::string&, size_t)> bind_fn) {
+      for_each_weights([&bind_fn](const std::string& name, Weights<elem_t>& weights) {
+        weights.view(bind_fn(name, weights.size()));
+      });
     }
 
     void resize(const std::vector<size_t>& stage_repeats, const std::vector<size_t>& output_channels) {
@@ -139,6 +116,50 @@ public:
     }
 
   private:
+    // the parameter file names, in file order
+    template <class Fn>
+    void for_each_weights(Fn fn) {
+      fn("c1w", conv_pre_.weights());
+      fn("c1b", conv_pre_.bias());
+      fn("c5w", conv_post_.weights());
+      fn("c5b", conv_post_.bias());
+      fn("fcw", fc_.weights());
+      fn("fcb", fc_.bias());
+
+      int stage_nr = 2;
+      for (auto& stage : stages_) {
+        int repeat_nr = 0;
+        for (auto& repeat : stage) {
+          std::ostringstream oss;
+          oss << "s" << stage_nr << "r" << repeat_nr;
+          std::string prefix = oss.str();
+
+          auto repeat_fn = [&prefix, &fn, &repeat](const std::string& suffix){
+            fn(prefix + "x" + suffix, *repeat.weights(suffix[0], suffix[1], suffix[2]));
+          };
+
+          // branch1
+          if (repeat.has_branch1()) {
+            repeat_fn("1w0");
+            repeat_fn("1b0");
+            repeat_fn("1w1");
+            repeat_fn("1b1");
+          }
+
+          // branch2
+          repeat_fn("2w0");
+          repeat_fn("2b0");
+          repeat_fn("2w1");
+          repeat_fn("2b1");
+          repeat_fn("2w2");
+          repeat_fn("2b2");
+
+          repeat_nr++;
+        }
+        stage_nr++;
+      }
+    }
+
     typename Conv2D<elem_t>::Params conv_pre_;
     typename Maxpool2D<elem_t>::Params maxpool_;
     typename std::list<std::list<typename InvertedResidual<elem_t>::Params>> stages_;
@@ -153,70 +174,168 @@ public:
   Model& operator=(const Model&) = delete;
   Model& operator=(Model&&) = delete;
 
+  // times every operator on forward(), call before setup()
+  void profile(Profiler& profiler) noexcept {
+    profiler_ = &profiler;
+  }
+
   void setup(const Frame<float>& input, Frame<float>& output, const Params& params) {
     assert(input.channels() == 3);
     assert(output.width() == 1);
     assert(output.height() == 1);
     assert(output.channels() == 1);
+    assert(output.batch() == input.batch());
 
+    batch_ = input.batch();
     size_t h = input.height();
     size_t w = input.width();
 
+    // plan every intermediate, including those of the repeats, into one
+    // arena before the operators bind their pointers
     h /= 2;
     w /= 2;
-    auto& after_conv_pre = create_intermediate(h, w, params.conv_pre_params().output_feature());
-    conv_pre_.setup(input, after_conv_pre, params.conv_pre_params());
+    size_t after_conv_pre = planner_.request(batch_, h, w, params.conv_pre_params().output_feature());
+    planner_.use({after_conv_pre}, planner_.schedule());
 
     h /= 2;
     w /= 2;
-    auto& after_maxpool = create_intermediate(h, w, after_conv_pre.channels());
-    maxpool_.setup(after_conv_pre, after_maxpool, params.maxpool_params());
+    size_t after_maxpool = planner_.request(batch_, h, w, params.conv_pre_params().output_feature());
+    planner_.use({after_conv_pre, after_maxpool}, planner_.schedule());
 
-    const auto* last_frame = &after_maxpool;
+    std::vector<size_t> after_repeats;
+    size_t last = after_maxpool;
     for (const auto& stage_param : params.stages_params()) {
       h /= 2;
       w /= 2;
       for (const auto& repeat_param : stage_param) {
-        auto& after_repeat = create_intermediate(h, w, repeat_param.output_feature());
+        size_t after_repeat = planner_.request(batch_, h, w, repeat_param.output_feature());
         stage_repeats_.emplace_back();
-        stage_repeats_.back().setup(*last_frame, after_repeat, repeat_param);
-        last_frame = &after_repeat;
+        stage_repeats_.back().plan(planner_, last, after_repeat, repeat_param);
+        after_repeats.push_back(after_repeat);
+        last = after_repeat;
+      }
+    }
+
+    size_t after_conv_post = planner_.request(batch_, h, w, params.conv_post_params().output_feature());
+    planner_.use({last, after_conv_post}, planner_.schedule());
+
+    size_t after_mean = planner_.request(batch_, 1, 1, params.conv_post_params().output_feature());
+    planner_.use({after_conv_post, after_mean}, planner_.schedule());
+    planner_.use({after_mean}, planner_.schedule());
+
+    planner_.plan();
+
+    auto& after_conv_pre_frame = create_intermediate(after_conv_pre);
+    conv_pre_.setup(input, after_conv_pre_frame, params.conv_pre_params());
+    conv_pre_op_ = register_op("conv_pre", conv_pre_.cost());
+
+    auto& after_maxpool_frame = create_intermediate(after_maxpool);
+    maxpool_.setup(after_conv_pre_frame, after_maxpool_frame, params.maxpool_params());
+    maxpool_op_ = register_op("maxpool", maxpool_.cost());
+
+    const auto* last_frame = &after_maxpool_frame;
+    auto repeat = stage_repeats_.begin();
+    auto after_repeat = after_repeats.begin();
+    int stage_nr = 2;
+    for (const auto& stage_param : params.stages_params()) {
+      int repeat_nr = 0;
+      for (const auto& repeat_param : stage_param) {
+        auto& after_repeat_frame = create_intermediate(*after_repeat++);
+        repeat->setup(*last_frame, after_repeat_frame, repeat_param);
+        if (profiler_) {
+          // same names as the parameter files
+          std::ostringstream oss;
+          oss << "s" << stage_nr << "r" << repeat_nr;
+          repeat->profile(*profiler_, oss.str());
+        }
+        last_frame = &after_repeat_frame;
+        ++repeat;
+        repeat_nr++;
       }
+      stage_ends_.push_back(std::distance(stage_repeats_.begin(), repeat));
+      stage_nr++;
     }
 
-    auto& after_conv_post = create_intermediate(h, w, params.conv_post_params().output_feature());
-    conv_post_.setup(*last_frame, after_conv_post, params.conv_post_params());
+    auto& after_conv_post_frame = create_intermediate(after_conv_post);
+    conv_post_.setup(*last_frame, after_conv_post_frame, params.conv_post_params());
+    conv_post_op_ = register_op("conv_post", conv_post_.cost());
 
-    auto& after_mean = create_intermediate(1, 1, after_conv_post.channels());
-    mean_.setup(after_conv_post, after_mean);
+    auto& after_mean_frame = create_intermediate(after_mean);
+    mean_.setup(after_conv_post_frame, after_mean_frame);
+    mean_op_ = register_op("mean", mean_.cost());
 
-    fc_.setup(after_mean, output, params.fc_params());
+    fc_.setup(after_mean_frame, output, params.fc_params());
+    fc_op_ = register_op("fc", fc_.cost());
+  }
+
+  //! Bytes of the activation arena, after setup()
+  size_t activation_bytes() const noexcept {
+    return planner_.footprint();
+  }
+
+  //! Bytes the activations would take without buffer reuse
+  size_t unplanned_activation_bytes() const noexcept {
+    return planner_.total_bytes();
   }
 
   void forward() {
-    conv_pre_.forward();
-    maxpool_.forward();
+    using latency_assessment::report_timepoint;
+    using latency_assessment::trace_stage_t;
+
+    profiled(profiler_, conv_pre_op_, [this]{ conv_pre_.forward(); });
+    report_timepoint(trace_stage_t::conv_pre);
+    profiled(profiler_, maxpool_op_, [this]{ maxpool_.forward(); });
+    report_timepoint(trace_stage_t::maxpool);
+    size_t index = 0, stage = 0;
     for (auto& repeat : stage_repeats_) {
       repeat.forward();
+      index++;
+      while (stage < stage_ends_.size() && index == stage_ends_[stage]) {
+        report_timepoint(trace_stage(stage++));
+      }
     }
-    conv_post_.forward();
-    mean_.forward();
-    fc_.forward();
+    profiled(profiler_, conv_post_op_, [this]{ conv_post_.forward(); });
+    report_timepoint(trace_stage_t::conv_post);
+    profiled(profiler_, mean_op_, [this]{ mean_.forward(); });
+    report_timepoint(trace_stage_t::mean);
+    profiled(profiler_, fc_op_, [this]{ fc_.forward(); });
+    report_timepoint(trace_stage_t::inferred);
   }
 
 private:
-  Frame<elem_t>& create_intermediate(size_t height, size_t width, size_t channels) {
-    intermediate_.emplace_back(height, width, channels);
+  // stages past the third are traced as the last one
+  static latency_assessment::trace_stage_t trace_stage(size_t stage) noexcept {
+    using latency_assessment::trace_stage_t;
+    constexpr size_t first = static_cast<size_t>(trace_stage_t::stage2);
+    constexpr size_t last = static_cast<size_t>(trace_stage_t::stage4);
+    return static_cast<trace_stage_t>(std::min(first + stage, last));
+  }
+
+  size_t register_op(const std::string& name, const OpCost& cost) {
+    return profiler_ ? profiler_->add(name, cost) : 0;
+  }
+
+  Frame<elem_t>& create_intermediate(size_t buffer) {
+    intermediate_.push_back(planner_.frame(buffer));
     return intermediate_.back();
   }
 
   Conv2D<elem_t> conv_pre_;
   Maxpool2D<elem_t> maxpool_;
   std::list<InvertedResidual<elem_t>> stage_repeats_;
+  std::vector<size_t> stage_ends_; // index past the last repeat of each stage
   Conv2D<elem_t> conv_post_;
   GlobalAveragePool2D<elem_t> mean_;
   Fc<elem_t> fc_;
+  size_t batch_ = 1;
+  MemoryPlanner<elem_t> planner_;
   std::list<Frame<elem_t>> intermediate_;
+  Profiler* profiler_ = nullptr;
+  size_t conv_pre_op_ = 0;
+  size_t maxpool_op_ = 0;
+  size_t conv_post_op_ = 0;
+  size_t mean_op_ = 0;
+  size_t fc_op_ = 0;
 };
 
 }
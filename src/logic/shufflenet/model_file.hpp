@@ -0,0 +1,229 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rpi_rt::logic::shufflenet {
+
+/**
+ * All parameters of the model packed into one file, read through mmap.
+ *
+ * Layout, little endian:
+ *   header   64 bytes: magic, version, tensor count, file size and the
+ *            CRC-32 (zlib's) of everything after the header
+ *   index    one 64 byte entry per tensor: name, offset, element count
+ *   tensors  fp32, each at a 64 byte aligned offset
+ *
+ * The mapping is read only and shared with the page cache, so weights are
+ * handed to XNNPACK in place (Model::Params::bind()) and never copied. A
+ * truncated or otherwise torn file fails the size or checksum check on
+ * open, instead of running with garbage weights.
+ */
+class ModelFile {
+public:
+  static constexpr uint32_t version = 1;
+  static constexpr size_t alignment = 64;
+
+  //! One tensor to write()
+  struct tensor_t {
+    std::string name;
+    const float* data;
+    size_t size;
+  };
+
+  explicit ModelFile(const std::string& path) : path_(path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      fail("cannot open");
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(header_t))) {
+      ::close(fd);
+      fail("not a model file");
+    }
+    size_ = st.st_size;
+    void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      fail("mmap failed");
+    }
+    data_ = static_cast<const uint8_t*>(data);
+
+    try {
+      validate();
+    } catch (...) {
+      ::munmap(const_cast<uint8_t*>(data_), size_);
+      throw;
+    }
+  }
+
+  ~ModelFile() {
+    ::munmap(const_cast<uint8_t*>(data_), size_);
+  }
+
+  ModelFile(const ModelFile&) = delete;
+  ModelFile(ModelFile&&) = delete;
+  ModelFile& operator=(const ModelFile&) = delete;
+  ModelFile& operator=(ModelFile&&) = delete;
+
+  //! The size floats of tensor name, valid as long as this file
+  const float* tensor(const std::string& name, size_t size) const {
+    auto it = index_.find(name);
+    if (it == index_.end()) {
+      fail(name + " missing");
+    }
+    if (it->second.size != size) {
+      fail(name + " size mismatch");
+    }
+    return reinterpret_cast<const float*>(data_ + it->second.offset);
+  }
+
+  //! The number of tensors
+  size_t size() const noexcept {
+    return index_.size();
+  }
+
+  //! The whole mapping, to tell whether a pointer is one of its tensors
+  const uint8_t* data() const noexcept {
+    return data_;
+  }
+
+  size_t bytes() const noexcept {
+    return size_;
+  }
+
+  //! Identifies the content, as stored in the header
+  uint32_t checksum() const noexcept {
+    return checksum_;
+  }
+
+  //! zlib's CRC-32
+  static uint32_t crc32(const uint8_t* data, size_t size) noexcept {
+    static const auto table = [] {
+      std::array<uint32_t, 256> t{};
+      for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+          c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        t[i] = c;
+      }
+      return t;
+    }();
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < size; i++) {
+      crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+  }
+
+  static void write(std::ostream& os, const std::vector<tensor_t>& tensors) {
+    size_t offset = sizeof(header_t) + tensors.size() * sizeof(entry_t);
+    std::vector<entry_t> index;
+    for (const auto& t : tensors) {
+      entry_t e{};
+      if (t.name.size() >= sizeof(e.name)) {
+        throw std::runtime_error("shufflenet: tensor name too long: " + t.name);
+      }
+      std::memcpy(e.name, t.name.data(), t.name.size());
+      offset = align(offset);
+      e.offset = offset;
+      e.size = t.size;
+      offset += t.size * sizeof(float);
+      index.push_back(e);
+    }
+
+    std::vector<uint8_t> file(offset, 0);
+    std::memcpy(file.data() + sizeof(header_t), index.data(), index.size() * sizeof(entry_t));
+    for (size_t i = 0; i < tensors.size(); i++) {
+      std::memcpy(file.data() + index[i].offset, tensors[i].data, tensors[i].size * sizeof(float));
+    }
+
+    header_t header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.count = tensors.size();
+    header.file_size = file.size();
+    header.checksum = crc32(file.data() + sizeof(header_t), file.size() - sizeof(header_t));
+    std::memcpy(file.data(), &header, sizeof(header));
+
+    os.write(reinterpret_cast<const char*>(file.data()), file.size());
+  }
+
+private:
+  static constexpr char magic[8] = {'S', 'I', 'R', 'E', 'N', 'M', 'D', 'L'};
+
+  struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t file_size;
+    uint32_t checksum;
+    uint8_t reserved[36];
+  };
+  static_assert(sizeof(header_t) == 64);
+
+  struct entry_t {
+    char name[48];  //!< zero terminated
+    uint64_t offset;
+    uint64_t size;  //!< in floats
+  };
+  static_assert(sizeof(entry_t) == 64);
+
+  static size_t align(size_t offset) noexcept {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  void validate() {
+    header_t header;
+    std::memcpy(&header, data_, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+      fail("not a model file");
+    }
+    if (header.version != version) {
+      fail("unsupported version " + std::to_string(header.version));
+    }
+    if (header.file_size != size_) {
+      fail("truncated, expected " + std::to_string(header.file_size) + " bytes");
+    }
+    if (crc32(data_ + sizeof(header_t), size_ - sizeof(header_t)) != header.checksum) {
+      fail("checksum mismatch");
+    }
+    checksum_ = header.checksum;
+    if (sizeof(header_t) + header.count * sizeof(entry_t) > size_) {
+      fail("index out of range");
+    }
+
+    const auto* entries = reinterpret_cast<const entry_t*>(data_ + sizeof(header_t));
+    for (uint32_t i = 0; i < header.count; i++) {
+      const auto& e = entries[i];
+      if (e.offset % alignment != 0 || e.offset > size_ || e.size > (size_ - e.offset) / sizeof(float)) {
+        fail("tensor out of range");
+      }
+      index_[std::string(e.name, strnlen(e.name, sizeof(e.name)))] = e;
+    }
+  }
+
+  [[noreturn]] void fail(const std::string& what) const {
+    throw std::runtime_error("shufflenet: " + path_ + ": " + what);
+  }
+
+  std::string path_;
+  const uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+  uint32_t checksum_ = 0;
+  std::unordered_map<std::string, entry_t> index_;
+};
+
+}
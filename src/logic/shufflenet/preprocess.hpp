@@ -9,6 +9,12 @@
 #include <cassert>
 #include <optional>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "xnnpack.h"
 #include "xnn_common.hpp"
 #include "frame.hpp"
@@ -19,7 +25,10 @@ class Preprocess {
 public:
   Preprocess() {}
   ~Preprocess() {
-    xnn_delete_operator(resize_op_);
+    if (resize_op_) {
+      xnn_delete_operator(resize_op_);
+      XNNPackGuard::instance().release();
+    }
   }
 
   Preprocess(const Preprocess&) = delete;
@@ -45,13 +54,25 @@ public:
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_create_resize_bilinear2d_nhwc_u8");
     }
+    XNNPackGuard::instance().retain();
 
     output_ptr_ = output.data();
+    output_batch_ = output.batch();
   }
 
-  void process(const Frame<uint8_t>& input) {
+  // writes image index of a batched output
+  void process(const Frame<uint8_t>& input, size_t index = 0) {
     (void)XNNPackGuard::instance();
     assert(input.channels() == channels);
+    assert(index < output_batch_);
+
+    float* output_ptr = output_ptr_ + index * small_size * small_size * channels;
+
+    if (input.height() == small_size && input.width() == small_size) {
+      // the sensor already downscaled, e.g. libcamera_config_t::output_width
+      normalize(input.data(), output_ptr, small_size * small_size);
+      return;
+    }
 
     xnn_status status;
 
@@ -66,7 +87,7 @@ public:
         channels,
         &workspace_size,
         &workspace_alignment,
-        nullptr);
+        XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_reshape_resize_bilinear2d_nhwc_u8");
     }
@@ -80,34 +101,98 @@ public:
       throw std::runtime_error("xnn_setup_resize_bilinear2d_nhwc_u8");
     }
 
-    status = xnn_run_operator(resize_op_, nullptr);
+    status = xnn_run_operator(resize_op_, XNNPackGuard::instance().threadpool());
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_run_operator(resize_bilinear2d_nhwc)");
     }
 
-    // okay this is not pretty, but I have yet to found a fused operator in XNNPACK
-    // for u8 -> f32 conversion AND ImageNet normalization ..
-    // weighed versus more internal buffers, this code is reasonably good
-    for (size_t y = 0; y < small_size; y++) {
-      for (size_t x = 0; x < small_size; x++) {
-        uint8_t* in_pixel = resize_output_.data() + ((y * small_size) + x) * channels;
-        float* out_pixel = output_ptr_ + ((y * small_size) + x) * channels;
-
-        // transforms.Normalize((0.485, 0.456, 0.406), (0.229, 0.224, 0.225))
-        out_pixel[0] = (float(in_pixel[0]) / 255.0 - 0.485) / 0.229; // R
-        out_pixel[1] = (float(in_pixel[1]) / 255.0 - 0.456) / 0.224; // G
-        out_pixel[2] = (float(in_pixel[2]) / 255.0 - 0.406) / 0.225; // B
+    normalize(resize_output_.data(), output_ptr, small_size * small_size);
+  }
+
+  /**
+   * u8 RGB -> ImageNet-normalized f32 RGB in one pass,
+   * transforms.Normalize((0.485, 0.456, 0.406), (0.229, 0.224, 0.225))
+   * folded into out = in * scale[c] + bias[c].
+   *
+   * The channels repeat every 3 elements, so 4 lanes see the same
+   * scale/bias pattern again after 12 elements (4 pixels).
+   */
+  static void normalize(const uint8_t* in, float* out, size_t pixels) {
+    const size_t size = pixels * channels;
+    size_t i = 0;
+
+#if defined(__ARM_NEON) || defined(__SSE2__)
+    alignas(16) float scale12[12], bias12[12];
+    for (size_t j = 0; j < 12; j++) {
+      scale12[j] = scale[j % channels];
+      bias12[j] = bias[j % channels];
+    }
+#endif
+
+#if defined(__ARM_NEON)
+    const float32x4_t s0 = vld1q_f32(scale12), s1 = vld1q_f32(scale12 + 4), s2 = vld1q_f32(scale12 + 8);
+    const float32x4_t b0 = vld1q_f32(bias12), b1 = vld1q_f32(bias12 + 4), b2 = vld1q_f32(bias12 + 8);
+    for (; i + 48 <= size; i += 48) {
+      // 48 bytes = 16 pixels, 4 periods of the pattern
+      const uint8x16_t u[3] = {vld1q_u8(in + i), vld1q_u8(in + i + 16), vld1q_u8(in + i + 32)};
+      float32x4_t f[12];
+      for (size_t k = 0; k < 3; k++) {
+        const uint16x8_t lo = vmovl_u8(vget_low_u8(u[k]));
+        const uint16x8_t hi = vmovl_u8(vget_high_u8(u[k]));
+        f[k * 4 + 0] = vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo)));
+        f[k * 4 + 1] = vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo)));
+        f[k * 4 + 2] = vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi)));
+        f[k * 4 + 3] = vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi)));
+      }
+      for (size_t k = 0; k < 12; k += 3) {
+        vst1q_f32(out + i + k * 4 + 0, vmlaq_f32(b0, f[k + 0], s0));
+        vst1q_f32(out + i + k * 4 + 4, vmlaq_f32(b1, f[k + 1], s1));
+        vst1q_f32(out + i + k * 4 + 8, vmlaq_f32(b2, f[k + 2], s2));
+      }
+    }
+#elif defined(__SSE2__)
+    const __m128 s0 = _mm_load_ps(scale12), s1 = _mm_load_ps(scale12 + 4), s2 = _mm_load_ps(scale12 + 8);
+    const __m128 b0 = _mm_load_ps(bias12), b1 = _mm_load_ps(bias12 + 4), b2 = _mm_load_ps(bias12 + 8);
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 48 <= size; i += 48) {
+      // 48 bytes = 16 pixels, 4 periods of the pattern
+      __m128 f[12];
+      for (size_t k = 0; k < 3; k++) {
+        const __m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + k * 16));
+        const __m128i lo = _mm_unpacklo_epi8(u, zero);
+        const __m128i hi = _mm_unpackhi_epi8(u, zero);
+        f[k * 4 + 0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+        f[k * 4 + 1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+        f[k * 4 + 2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+        f[k * 4 + 3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+      }
+      for (size_t k = 0; k < 12; k += 3) {
+        _mm_storeu_ps(out + i + k * 4 + 0, _mm_add_ps(_mm_mul_ps(f[k + 0], s0), b0));
+        _mm_storeu_ps(out + i + k * 4 + 4, _mm_add_ps(_mm_mul_ps(f[k + 1], s1), b1));
+        _mm_storeu_ps(out + i + k * 4 + 8, _mm_add_ps(_mm_mul_ps(f[k + 2], s2), b2));
       }
     }
+#endif
+
+    for (; i < size; i++) {
+      out[i] = float(in[i]) * scale[i % channels] + bias[i % channels];
+    }
   }
 
   Frame<uint8_t> resize_output_;
 private:
   xnn_operator_t resize_op_ = nullptr;
   float* output_ptr_ = nullptr;
+  size_t output_batch_ = 1;
 
   constexpr static size_t small_size = 224;
   constexpr static size_t channels = 3;
+
+  // 1 / (255 * std) and -mean / std
+  constexpr static float scale[channels] = {
+    float(1.0 / (255.0 * 0.229)), float(1.0 / (255.0 * 0.224)), float(1.0 / (255.0 * 0.225))};
+  constexpr static float bias[channels] = {
+    float(-0.485 / 0.229), float(-0.456 / 0.224), float(-0.406 / 0.225)};
 };
 
 }
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "frame.hpp"
+
+namespace rpi_rt::logic::shufflenet {
+
+/**
+ * The work one forward() of an operator does, filled in by its setup().
+ *
+ * A multiply-add counts as two FLOPs. Bytes are the activations read and
+ * written plus the weights, as if nothing stayed in cache.
+ */
+struct OpCost {
+  uint64_t flops = 0;
+  uint64_t bytes = 0;
+};
+
+template <class Elem>
+uint64_t frame_bytes(const Frame<Elem>& frame) noexcept {
+  return frame.size() * sizeof(Elem);
+}
+
+/**
+ * Per operator wall time of the operator backend (Model).
+ *
+ * Attach it with Model::profile() before setup(); operators register in
+ * the order they run and every forward() then times each of them. The
+ * result is a table or a Chrome trace (chrome://tracing, ui.perfetto.dev).
+ *
+ * Totals cover every forward(), trace events only the first max_events,
+ * so a long running profile doesn't grow without bound.
+ */
+class Profiler {
+public:
+  static constexpr size_t max_events = 100000;
+
+  Profiler() {}
+
+  Profiler(const Profiler&) = delete;
+  Profiler& operator=(const Profiler&) = delete;
+
+  //! Called by operators on setup, returns the id to measure() with
+  size_t add(std::string name, const OpCost& cost) {
+    ops_.push_back(op_t{std::move(name), cost});
+    return ops_.size() - 1;
+  }
+
+  template <class Fn>
+  void measure(size_t op, Fn&& fn) {
+    auto begin = clock_t::now();
+    fn();
+    auto end = clock_t::now();
+
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    auto& o = ops_[op];
+    o.calls++;
+    o.total_ns += ns;
+    o.min_ns = std::min(o.min_ns, ns);
+    o.max_ns = std::max(o.max_ns, ns);
+
+    if (events_.size() < max_events) {
+      if (events_.empty()) {
+        epoch_ = begin;
+      }
+      uint64_t start_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - epoch_).count();
+      events_.push_back(event_t{op, start_ns, ns});
+    }
+  }
+
+  size_t size() const noexcept {
+    return ops_.size();
+  }
+
+  //! Forgets all timings, e.g. after warming up; keeps the operators
+  void reset() {
+    for (auto& o : ops_) {
+      o.calls = 0;
+      o.total_ns = 0;
+      o.min_ns = std::numeric_limits<uint64_t>::max();
+      o.max_ns = 0;
+    }
+    events_.clear();
+  }
+
+  /**
+   * One row per operator: calls, mean/min/max time, share of the total,
+   * and the FLOP and memory throughput it reached.
+   */
+  void print_table(std::ostream& os) const {
+    uint64_t total_ns = 0;
+    size_t width = 8;
+    for (const auto& o : ops_) {
+      total_ns += o.total_ns;
+      width = std::max(width, o.name.size());
+    }
+
+    auto flags = os.flags();
+    os << std::left << std::setw(width) << "operator" << std::right
+      << std::setw(8) << "calls"
+      << std::setw(10) << "mean us"
+      << std::setw(10) << "min us"
+      << std::setw(10) << "max us"
+      << std::setw(8) << "%"
+      << std::setw(10) << "MFLOP"
+      << std::setw(10) << "GFLOP/s"
+      << std::setw(10) << "MB"
+      << std::setw(10) << "GB/s" << "\n";
+    os << std::fixed;
+    for (const auto& o : ops_) {
+      double mean_ns = o.calls ? double(o.total_ns) / o.calls : 0.0;
+      os << std::left << std::setw(width) << o.name << std::right
+        << std::setw(8) << o.calls
+        << std::setprecision(1)
+        << std::setw(10) << mean_ns / 1e3
+        << std::setw(10) << (o.calls ? o.min_ns : 0) / 1e3
+        << std::setw(10) << o.max_ns / 1e3
+        << std::setw(8) << (total_ns ? 100.0 * o.total_ns / total_ns : 0.0)
+        << std::setprecision(2)
+        << std::setw(10) << o.cost.flops / 1e6
+        << std::setw(10) << (mean_ns > 0 ? o.cost.flops / mean_ns : 0.0)
+        << std::setw(10) << o.cost.bytes / 1e6
+        << std::setw(10) << (mean_ns > 0 ? o.cost.bytes / mean_ns : 0.0) << "\n";
+    }
+    os << "total " << std::setprecision(1) << total_ns / 1e3 << " us\n";
+    os.flags(flags);
+  }
+
+  //! Chrome trace event format, one complete ("X") event per measure()
+  void write_chrome_trace(std::ostream& os) const {
+    auto flags = os.flags();
+    os << std::fixed << std::setprecision(3);
+    os << "{\"traceEvents\":[";
+    for (size_t i = 0; i < events_.size(); i++) {
+      const auto& e = events_[i];
+      const auto& o = ops_[e.op];
+      os << (i ? ",\n" : "\n")
+        << "{\"name\":\"" << o.name << "\",\"cat\":\"shufflenet\",\"ph\":\"X\""
+        << ",\"ts\":" << e.start_ns / 1e3 << ",\"dur\":" << e.duration_ns / 1e3
+        << ",\"pid\":0,\"tid\":0,\"args\":{\"flops\":" << o.cost.flops
+        << ",\"bytes\":" << o.cost.bytes << "}}";
+    }
+    os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    os.flags(flags);
+  }
+
+private:
+  using clock_t = std::chrono::steady_clock;
+
+  struct op_t {
+    std::string name;
+    OpCost cost;
+    uint64_t calls = 0;
+    uint64_t total_ns = 0;
+    uint64_t min_ns = std::numeric_limits<uint64_t>::max();
+    uint64_t max_ns = 0;
+  };
+
+  struct event_t {
+    size_t op;
+    uint64_t start_ns;  //!< since the first event
+    uint64_t duration_ns;
+  };
+
+  std::vector<op_t> ops_;
+  std::vector<event_t> events_;
+  clock_t::time_point epoch_;
+};
+
+/**
+ * Runs fn, timed as op if there is a profiler. Lets operators keep a
+ * single forward() for both modes.
+ */
+template <class Fn>
+void profiled(Profiler* profiler, size_t op, Fn&& fn) {
+  if (profiler) {
+    profiler->measure(op, fn);
+  } else {
+    fn();
+  }
+}
+
+}
@@ -9,7 +9,14 @@
 #include <cmath>
 #include <cassert>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "frame.hpp"
+#include "profiler.hpp"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -25,32 +32,89 @@ public:
   Shuffle& operator=(const Shuffle&) = delete;
   Shuffle& operator=(Shuffle&&) = delete;
 
+  /**
+   * input_a may have more channels than input_b, e.g. the whole block
+   * input whose first half passes through unchanged; only its first
+   * input_b.channels() channels are read, in place.
+   */
   void setup(const Frame<elem_t>& input_a, const Frame<elem_t>& input_b, Frame<elem_t>& output) {
-    assert(input_a.channels() == input_b.channels());
-    assert(input_a.channels() + input_b.channels() == output.channels());
+    assert(input_a.channels() >= input_b.channels());
+    assert(2 * input_b.channels() == output.channels());
     assert(input_a.width() == input_b.width());
     assert(input_a.height() == input_b.height());
     assert(input_a.width() == output.width());
     assert(input_a.height() == output.height());
+    assert(input_a.batch() == output.batch());
 
-    repeats_ = input_a.width() * input_a.height() * input_a.channels();
+    pixels_ = input_b.batch() * input_b.width() * input_b.height();
+    channels_ = input_b.channels();
+    stride_a_ = input_a.channels();
     input_a_ = input_a.data();
     input_b_ = input_b.data();
     output_ = output.data();
+
+    // a plain copy, every element read and written once
+    cost_.bytes = 2 * frame_bytes(output);
   }
 
   void forward() {
-    for (size_t i = 0; i < repeats_; i++) {
-      output_[i * 2 + 0] = input_a_[i];
-      output_[i * 2 + 1] = input_b_[i];
+    if (stride_a_ == channels_) {
+      interleave(input_a_, input_b_, output_, pixels_ * channels_);
+      return;
+    }
+    for (size_t i = 0; i < pixels_; i++) {
+      interleave(input_a_ + i * stride_a_, input_b_ + i * channels_, output_ + i * 2 * channels_, channels_);
     }
   }
 
+  /**
+   * out = a0 b0 a1 b1 ..., the channel shuffle with 2 groups.
+   *
+   * Stride-2 scalar stores don't vectorize, so pairs of 4 lane registers
+   * are zipped and written as full vectors, 8 elements of each input per
+   * iteration.
+   */
+  static void interleave(const elem_t* a, const elem_t* b, elem_t* out, size_t size) {
+    size_t i = 0;
+
+    if constexpr (std::is_same_v<elem_t, float>) {
+#if defined(__ARM_NEON)
+      for (; i + 8 <= size; i += 8) {
+        const float32x4x2_t v0 = {{vld1q_f32(a + i + 0), vld1q_f32(b + i + 0)}};
+        const float32x4x2_t v1 = {{vld1q_f32(a + i + 4), vld1q_f32(b + i + 4)}};
+        vst2q_f32(out + 2 * i + 0, v0);
+        vst2q_f32(out + 2 * i + 8, v1);
+      }
+#elif defined(__SSE2__)
+      for (; i + 8 <= size; i += 8) {
+        const __m128 a0 = _mm_loadu_ps(a + i + 0), b0 = _mm_loadu_ps(b + i + 0);
+        const __m128 a1 = _mm_loadu_ps(a + i + 4), b1 = _mm_loadu_ps(b + i + 4);
+        _mm_storeu_ps(out + 2 * i + 0, _mm_unpacklo_ps(a0, b0));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(a0, b0));
+        _mm_storeu_ps(out + 2 * i + 8, _mm_unpacklo_ps(a1, b1));
+        _mm_storeu_ps(out + 2 * i + 12, _mm_unpackhi_ps(a1, b1));
+      }
+#endif
+    }
+
+    for (; i < size; i++) {
+      out[i * 2 + 0] = a[i];
+      out[i * 2 + 1] = b[i];
+    }
+  }
+
+  const OpCost& cost() const noexcept {
+    return cost_;
+  }
+
 private:
-  size_t repeats_ = 0;
+  size_t pixels_ = 0;
+  size_t channels_ = 0;
+  size_t stride_a_ = 0;
   const elem_t *input_a_ = nullptr;
   const elem_t *input_b_ = nullptr;
   elem_t *output_ = nullptr;
+  OpCost cost_;
 };
 
 }
@@ -0,0 +1,666 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+#include "xnnpack.h"
+#include "xnn_common.hpp"
+#include "calibration.hpp"
+#include "model.hpp"
+#include "frame.hpp"
+
+namespace rpi_rt::logic::shufflenet {
+
+/*
+ShuffleNetV2 lowered into a single XNNPACK subgraph and runtime.
+
+- Drop-in alternative to Model<float>: takes the same Params, setup() and
+  forward() signatures. Input and output frames are always fp32.
+- Chunk is an even split, Shuffle is concat -> reshape -> transpose -> reshape,
+  so XNNPACK can fuse operators and plan intermediate memory itself.
+- Elem selects the activation type:
+    float   -> fp32 end to end. observe() records activation ranges into a
+               Calibration on every forward().
+    Float16 -> the fp32 graph run with XNN_FLAG_FORCE_FP16_INFERENCE: weights
+               are converted once at setup and activations stay fp16 between
+               operators. Needs fp16 arithmetic (ARMv8.2), setup throws
+               otherwise.
+    int8_t  -> QS8 activations with per-channel QC8 weights, using the ranges
+               from calibration(). The global average pool and the final fc
+               run in fp32 after dequantization.
+- Weights are referenced, not copied; params must outlive the model.
+*/
+template <class Elem>
+class SubgraphModel {
+public:
+  using elem_t = Elem;
+  using Params = typename Model<float>::Params;
+  static_assert(std::is_same_v<Elem, float> || std::is_same_v<Elem, Float16>
+      || std::is_same_v<Elem, int8_t>,
+      "Only F32, F16 and QS8 are implemented for SubgraphModel");
+
+  static constexpr bool quantized = std::is_same_v<Elem, int8_t>;
+  static constexpr bool half = std::is_same_v<Elem, Float16>;
+
+  SubgraphModel() {}
+  ~SubgraphModel() {
+    if (runtime_) {
+      xnn_delete_runtime(runtime_);
+      XNNPackGuard::instance().release();
+    }
+  }
+
+  SubgraphModel(const SubgraphModel&) = delete;
+  SubgraphModel(SubgraphModel&&) = delete;
+  SubgraphModel& operator=(const SubgraphModel&) = delete;
+  SubgraphModel& operator=(SubgraphModel&&) = delete;
+
+  // fp32 only: record activation ranges on every forward(). Call before setup.
+  void observe(Calibration& calibration) {
+    static_assert(std::is_same_v<Elem, float>, "observe() needs the fp32 model");
+    observer_ = &calibration;
+  }
+
+  // QS8 only: the activation ranges to quantize with. Call before setup.
+  void calibration(const Calibration& calibration) {
+    static_assert(quantized, "calibration() needs the quantized model");
+    calibration_ = &calibration;
+  }
+
+  void setup(const Frame<float>& input, Frame<float>& output, const Params& params) {
+    auto& guard = XNNPackGuard::instance();
+
+    assert(input.channels() == 3);
+    assert(output.width() == 1);
+    assert(output.height() == 1);
+    assert(output.channels() == 1);
+    assert(output.batch() == input.batch());
+
+    batch_ = input.batch();
+
+    if constexpr (quantized) {
+      if (!calibration_) {
+        throw std::runtime_error("shufflenet: quantized model set up without calibration");
+      }
+    }
+
+    xnn_status status;
+
+    xnn_subgraph_t subgraph = nullptr;
+    status = xnn_create_subgraph(external_value_bound(params), 0, &subgraph);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_create_subgraph");
+    }
+    subgraph_.reset(subgraph);
+
+    externals_.clear();
+    externals_.push_back({input_id, const_cast<float*>(input.data())});
+    externals_.push_back({output_id, output.data()});
+    next_external_id_ = output_id + 1;
+    activation_count_ = 0;
+
+    tensor_t x = define_input(input);
+    x = define_conv2d(params.conv_pre_params(), x);
+    x = define_maxpool2d(params.maxpool_params(), x);
+    for (const auto& stage_param : params.stages_params()) {
+      for (const auto& repeat_param : stage_param) {
+        x = define_inverted_residual(repeat_param, x);
+      }
+    }
+    x = define_conv2d(params.conv_post_params(), x);
+    x = define_mean(dequantize(x));
+    define_fc(params.fc_params(), x);
+
+    if constexpr (quantized) {
+      if (activation_count_ != calibration_->size()) {
+        throw std::runtime_error("shufflenet: calibration does not match the model");
+      }
+    }
+
+    status = xnn_create_runtime_v3(subgraph_.get(), guard.weights_cache(), guard.threadpool(),
+        half ? XNN_FLAG_FORCE_FP16_INFERENCE : 0, &runtime_);
+    if (half && status == xnn_status_unsupported_hardware) {
+      throw std::runtime_error("xnn_create_runtime_v3: fp16 inference unsupported on this CPU");
+    }
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_create_runtime_v3");
+    }
+    XNNPackGuard::instance().retain();
+    subgraph_ = nullptr;
+
+    status = xnn_reshape_runtime(runtime_);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_reshape_runtime");
+    }
+
+    status = xnn_setup_runtime_v2(runtime_, externals_.size(), externals_.data());
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_setup_runtime_v2");
+    }
+  }
+
+  void forward() {
+    xnn_status status;
+    status = xnn_invoke_runtime(runtime_);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_invoke_runtime");
+    }
+    // one fused runtime, no block boundaries to trace
+    latency_assessment::report_timepoint(latency_assessment::trace_stage_t::inferred);
+
+    if (observer_) {
+      size_t index = 0;
+      for (const auto& [data, size] : observed_) {
+        observer_->observe(index++, data, size);
+      }
+    }
+  }
+
+private:
+  // an NHWC value in the subgraph, N == batch_
+  struct tensor_t {
+    uint32_t id = XNN_INVALID_VALUE_ID;
+    size_t height = 0;
+    size_t width = 0;
+    size_t channels = 0;
+
+    // only meaningful for QS8 values
+    float scale = 1.0f;
+    int32_t zero_point = 0;
+  };
+
+  // every defined activation may become an external output when observing
+  static uint32_t external_value_bound(const Params& params) {
+    uint32_t bound = output_id + 1 + 3;
+    for (const auto& stage_param : params.stages_params()) {
+      for (const auto& repeat_param : stage_param) {
+        bound += repeat_param.has_branch1() ? 6 : 4;
+      }
+    }
+    return bound;
+  }
+
+  uint32_t define_value(const std::vector<size_t>& dims, const void* data = nullptr,
+      uint32_t external_id = XNN_INVALID_VALUE_ID, uint32_t flags = 0) {
+    uint32_t id = XNN_INVALID_VALUE_ID;
+    xnn_status status = xnn_define_tensor_value(
+        subgraph_.get(),
+        xnn_datatype_fp32,
+        dims.size(),
+        dims.data(),
+        data,
+        external_id,
+        flags,
+        &id);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_tensor_value");
+    }
+    return id;
+  }
+
+  uint32_t define_quantized_value(const std::vector<size_t>& dims, const tensor_t& quantization) {
+    uint32_t id = XNN_INVALID_VALUE_ID;
+    xnn_status status = xnn_define_quantized_tensor_value(
+        subgraph_.get(),
+        xnn_datatype_qint8,
+        quantization.zero_point,
+        quantization.scale,
+        dims.size(),
+        dims.data(),
+        nullptr,
+        XNN_INVALID_VALUE_ID,
+        0,
+        &id);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_quantized_tensor_value");
+    }
+    return id;
+  }
+
+  // asymmetric int8 covering the observed range, which always includes 0
+  static void quantization_from_range(const Calibration::range_t& range, tensor_t& t) {
+    float lo = std::min(range.min, 0.0f);
+    float hi = std::max(range.max, 0.0f);
+    t.scale = (hi - lo) / 255.0f;
+    if (t.scale == 0.0f) {
+      t.scale = 1.0f;
+    }
+    long zero_point = std::lround(-128.0f - lo / t.scale);
+    t.zero_point = static_cast<int32_t>(std::clamp(zero_point, -128l, 127l));
+  }
+
+  // a new activation with its own calibrated range
+  tensor_t define_activation(size_t height, size_t width, size_t channels) {
+    size_t index = activation_count_++;
+
+    tensor_t t;
+    t.height = height;
+    t.width = width;
+    t.channels = channels;
+
+    if constexpr (quantized) {
+      if (index >= calibration_->size()) {
+        throw std::runtime_error("shufflenet: calibration does not match the model");
+      }
+      quantization_from_range(calibration_->range(index), t);
+      t.id = define_quantized_value({batch_, height, width, channels}, t);
+    } else if (observer_) {
+      observed_frames_.emplace_back(batch_, height, width, channels);
+      auto& frame = observed_frames_.back();
+      observed_.emplace_back(frame.data(), frame.size());
+      uint32_t external_id = next_external_id_++;
+      externals_.push_back({external_id, frame.data()});
+      t.id = define_value({batch_, height, width, channels}, nullptr,
+          external_id, XNN_VALUE_FLAG_EXTERNAL_OUTPUT);
+    } else {
+      t.id = define_value({batch_, height, width, channels});
+    }
+    return t;
+  }
+
+  // an activation sharing the quantization of another, e.g. after a split
+  tensor_t define_activation_like(const std::vector<size_t>& dims, const tensor_t& like) {
+    tensor_t t = like;
+    if (dims.size() == 4) {
+      t.height = dims[1];
+      t.width = dims[2];
+      t.channels = dims[3];
+    }
+    if constexpr (quantized) {
+      t.id = define_quantized_value(dims, like);
+    } else {
+      t.id = define_value(dims);
+    }
+    return t;
+  }
+
+  void define_convert(const tensor_t& input, const tensor_t& output) {
+    xnn_status status = xnn_define_convert(
+        subgraph_.get(), input.id, output.id, 0);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_convert");
+    }
+  }
+
+  tensor_t define_input(const Frame<float>& input) {
+    tensor_t t;
+    t.height = input.height();
+    t.width = input.width();
+    t.channels = input.channels();
+    t.id = define_value({batch_, t.height, t.width, t.channels}, nullptr,
+        input_id, XNN_VALUE_FLAG_EXTERNAL_INPUT);
+
+    if constexpr (quantized) {
+      tensor_t q = define_activation(t.height, t.width, t.channels);
+      define_convert(t, q);
+      return q;
+    } else {
+      // the input takes the first calibration slot too
+      activation_count_++;
+      if (observer_) {
+        observed_.emplace_back(input.data(), input.size());
+      }
+      return t;
+    }
+  }
+
+  tensor_t dequantize(const tensor_t& input) {
+    if constexpr (quantized) {
+      tensor_t t = input;
+      t.id = define_value({batch_, t.height, t.width, t.channels});
+      define_convert(input, t);
+      return t;
+    } else {
+      return input;
+    }
+  }
+
+  // QS8 inputs to a concatenation must share its quantization
+  tensor_t requantize(const tensor_t& input, const tensor_t& like) {
+    if constexpr (quantized) {
+      if (input.scale == like.scale && input.zero_point == like.zero_point) {
+        return input;
+      }
+      tensor_t t = define_activation_like({batch_, input.height, input.width, input.channels}, like);
+      define_convert(input, t);
+      return t;
+    } else {
+      (void)like;
+      return input;
+    }
+  }
+
+  // fp32 weights as is, or per output channel symmetric QC8 weights with
+  // QC32 biases matching the input scale
+  std::pair<uint32_t, uint32_t> define_weights(const std::vector<size_t>& dims,
+      const float* weights, const float* bias, const tensor_t& input) {
+    const size_t out_channels = dims[0];
+
+    if constexpr (quantized) {
+      const size_t per_channel = std::accumulate(
+          dims.begin() + 1, dims.end(), size_t(1), std::multiplies<size_t>());
+
+      auto& scales = quantized_scales_.emplace_back(out_channels);
+      auto& qweights = quantized_weights_.emplace_back(out_channels * per_channel);
+      for (size_t c = 0; c < out_channels; c++) {
+        const float* w = weights + c * per_channel;
+        float absmax = 0.0f;
+        for (size_t i = 0; i < per_channel; i++) {
+          absmax = std::max(absmax, std::abs(w[i]));
+        }
+        scales[c] = absmax > 0.0f ? absmax / 127.0f : 1.0f;
+        for (size_t i = 0; i < per_channel; i++) {
+          qweights[c * per_channel + i] = static_cast<int8_t>(
+              std::clamp(std::lround(w[i] / scales[c]), -127l, 127l));
+        }
+      }
+
+      uint32_t filter_id = XNN_INVALID_VALUE_ID;
+      xnn_status status = xnn_define_channelwise_quantized_tensor_value(
+          subgraph_.get(),
+          xnn_datatype_qcint8,
+          scales.data(),
+          dims.size(),
+          0,
+          dims.data(),
+          qweights.data(),
+          XNN_INVALID_VALUE_ID,
+          0,
+          &filter_id);
+      if (status != xnn_status_success) {
+        throw std::runtime_error("xnn_define_channelwise_quantized_tensor_value");
+      }
+
+      uint32_t bias_id = XNN_INVALID_VALUE_ID;
+      if (bias) {
+        auto& bias_scales = quantized_scales_.emplace_back(out_channels);
+        auto& qbias = quantized_biases_.emplace_back(out_channels);
+        for (size_t c = 0; c < out_channels; c++) {
+          bias_scales[c] = input.scale * scales[c];
+          qbias[c] = static_cast<int32_t>(std::lround(bias[c] / bias_scales[c]));
+        }
+        size_t bias_dims[] = {out_channels};
+        status = xnn_define_channelwise_quantized_tensor_value(
+            subgraph_.get(),
+            xnn_datatype_qcint32,
+            bias_scales.data(),
+            1,
+            0,
+            bias_dims,
+            qbias.data(),
+            XNN_INVALID_VALUE_ID,
+            0,
+            &bias_id);
+        if (status != xnn_status_success) {
+          throw std::runtime_error("xnn_define_channelwise_quantized_tensor_value");
+        }
+      }
+      return {filter_id, bias_id};
+    } else {
+      (void)input;
+      uint32_t filter_id = define_value(dims, weights);
+      uint32_t bias_id = bias
+        ? define_value({out_channels}, bias)
+        : XNN_INVALID_VALUE_ID;
+      return {filter_id, bias_id};
+    }
+  }
+
+  static size_t output_size(size_t input, size_t kernel, size_t stride, size_t padding) {
+    return (input + 2 * padding - kernel) / stride + 1;
+  }
+
+  tensor_t define_conv2d(const typename Conv2D<float>::Params& params, const tensor_t& input) {
+    assert(input.channels == params.input_feature());
+
+    auto [filter_id, bias_id] = define_weights(
+        {params.output_feature(), params.kernel_height(), params.kernel_width(), params.input_feature()},
+        params.data(),
+        params.has_bias() ? params.bias().data() : nullptr,
+        input);
+    tensor_t output = define_activation(
+        output_size(input.height, params.kernel_height(), params.stride_height(), params.padding_height()),
+        output_size(input.width, params.kernel_width(), params.stride_width(), params.padding_width()),
+        params.output_feature());
+
+    xnn_status status = xnn_define_convolution_2d(
+        subgraph_.get(),
+        params.padding_height(), params.padding_width(),
+        params.padding_height(), params.padding_width(),
+        params.kernel_height(), params.kernel_width(),
+        params.stride_height(), params.stride_width(),
+        1, 1,
+        1,
+        params.input_feature(),
+        params.output_feature(),
+        params.relu() ? 0 : -INFINITY, INFINITY,
+        input.id,
+        filter_id,
+        bias_id,
+        output.id,
+        0);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_convolution_2d");
+    }
+    return output;
+  }
+
+  // defined as a grouped convolution, same as DepthwiseConv2D, so the
+  // (channels, kernel_height, kernel_width) weight layout is used as is
+  tensor_t define_depthwise_conv2d(const typename DepthwiseConv2D<float>::Params& params, const tensor_t& input) {
+    assert(input.channels == params.channels());
+
+    auto [filter_id, bias_id] = define_weights(
+        {params.channels(), params.kernel_height(), params.kernel_width(), 1},
+        params.data(),
+        params.has_bias() ? params.bias().data() : nullptr,
+        input);
+    tensor_t output = define_activation(
+        output_size(input.height, params.kernel_height(), params.stride_height(), params.padding_height()),
+        output_size(input.width, params.kernel_width(), params.stride_width(), params.padding_width()),
+        params.channels());
+
+    xnn_status status = xnn_define_convolution_2d(
+        subgraph_.get(),
+        params.padding_height(), params.padding_width(),
+        params.padding_height(), params.padding_width(),
+        params.kernel_height(), params.kernel_width(),
+        params.stride_height(), params.stride_width(),
+        1, 1,
+        params.channels(),
+        1,
+        1,
+        -INFINITY, INFINITY,
+        input.id,
+        filter_id,
+        bias_id,
+        output.id,
+        0);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_convolution_2d");
+    }
+    return output;
+  }
+
+  tensor_t define_maxpool2d(const typename Maxpool2D<float>::Params& params, const tensor_t& input) {
+    tensor_t output = define_activation_like({batch_,
+        output_size(input.height, params.height(), params.stride_height(), params.padding_height()),
+        output_size(input.width, params.width(), params.stride_width(), params.padding_width()),
+        input.channels}, input);
+
+    xnn_status status = xnn_define_max_pooling_2d(
+        subgraph_.get(),
+        params.padding_height(), params.padding_width(),
+        params.padding_height(), params.padding_width(),
+        params.height(), params.width(),
+        params.stride_height(), params.stride_width(),
+        params.dilation_height(), params.dilation_width(),
+        -INFINITY, INFINITY,
+        input.id,
+        output.id,
+        0);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_max_pooling_2d");
+    }
+    return output;
+  }
+
+  tensor_t define_inverted_residual(const typename InvertedResidual<float>::Params& params, const tensor_t& input) {
+    tensor_t out1;
+    tensor_t in2;
+    if (params.has_branch1()) {
+      const auto& branch1 = params.branch1_params();
+      out1 = define_depthwise_conv2d(branch1.first_conv_params(), input);
+      out1 = define_conv2d(branch1.second_conv_params(), out1);
+      in2 = input;
+    } else {
+      out1 = define_activation_like({batch_, input.height, input.width, input.channels / 2}, input);
+      in2 = define_activation_like({batch_, input.height, input.width, input.channels / 2}, input);
+      xnn_status status = xnn_define_even_split2(
+          subgraph_.get(), 3, input.id, out1.id, in2.id, 0);
+      if (status != xnn_status_success) {
+        throw std::runtime_error("xnn_define_even_split2");
+      }
+    }
+
+    const auto& branch2 = params.branch2_params();
+    tensor_t out2 = define_conv2d(branch2.first_conv_params(), in2);
+    out2 = define_depthwise_conv2d(branch2.second_conv_params(), out2);
+    out2 = define_conv2d(branch2.third_conv_params(), out2);
+
+    return define_shuffle(out1, out2);
+  }
+
+  // channel shuffle with 2 groups: [a0 .. an, b0 .. bn] -> [a0, b0, .. an, bn]
+  tensor_t define_shuffle(const tensor_t& input_a, const tensor_t& input_b) {
+    assert(input_a.channels == input_b.channels);
+    assert(input_a.height == input_b.height);
+    assert(input_a.width == input_b.width);
+
+    const size_t h = input_a.height;
+    const size_t w = input_a.width;
+    const size_t c = input_a.channels;
+
+    xnn_status status;
+
+    tensor_t concat = define_activation(h, w, 2 * c);
+    tensor_t a = requantize(input_a, concat);
+    tensor_t b = requantize(input_b, concat);
+    status = xnn_define_concatenate2(
+        subgraph_.get(), 3, a.id, b.id, concat.id, 0);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_concatenate2");
+    }
+
+    size_t grouped_shape[] = {batch_, h, w, 2, c};
+    tensor_t grouped = define_activation_like({batch_, h, w, 2, c}, concat);
+    status = xnn_define_static_reshape(
+        subgraph_.get(), 5, grouped_shape, concat.id, grouped.id, 0);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_static_reshape");
+    }
+
+    size_t perm[] = {0, 1, 2, 4, 3};
+    tensor_t transposed = define_activation_like({batch_, h, w, c, 2}, concat);
+    status = xnn_define_static_transpose(
+        subgraph_.get(), 5, perm, grouped.id, transposed.id, 0);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_static_transpose");
+    }
+
+    size_t output_shape[] = {batch_, h, w, 2 * c};
+    tensor_t output = define_activation_like({batch_, h, w, 2 * c}, concat);
+    status = xnn_define_static_reshape(
+        subgraph_.get(), 4, output_shape, transposed.id, output.id, 0);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_static_reshape");
+    }
+    return output;
+  }
+
+  // always fp32
+  tensor_t define_mean(const tensor_t& input) {
+    tensor_t output = input;
+    output.height = 1;
+    output.width = 1;
+    output.id = define_value({batch_, 1, 1, input.channels});
+
+    int64_t axes[] = {1, 2};
+    xnn_status status = xnn_define_static_reduce(
+        subgraph_.get(),
+        xnn_reduce_mean,
+        2,
+        axes,
+        input.id,
+        output.id,
+        XNN_FLAG_KEEP_DIMS);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_static_reduce");
+    }
+    return output;
+  }
+
+  // always fp32
+  void define_fc(const typename Fc<float>::Params& params, const tensor_t& input) {
+    assert(input.channels == params.input_feature());
+
+    uint32_t filter_id = define_value(
+        {params.output_feature(), params.input_feature()},
+        params.data());
+    uint32_t bias_id = params.has_bias()
+      ? define_value({params.output_feature()}, params.bias().data())
+      : XNN_INVALID_VALUE_ID;
+    uint32_t fc_output_id = define_value({batch_, 1, 1, params.output_feature()}, nullptr,
+        output_id, XNN_VALUE_FLAG_EXTERNAL_OUTPUT);
+
+    xnn_status status = xnn_define_fully_connected(
+        subgraph_.get(),
+        -INFINITY, INFINITY,
+        input.id,
+        filter_id,
+        bias_id,
+        fc_output_id,
+        0);
+    if (status != xnn_status_success) {
+      throw std::runtime_error("xnn_define_fully_connected");
+    }
+  }
+
+  struct subgraph_deleter {
+    void operator()(xnn_subgraph_t subgraph) const noexcept {
+      (void)xnn_delete_subgraph(subgraph);
+    }
+  };
+
+  static constexpr uint32_t input_id = 0;
+  static constexpr uint32_t output_id = 1;
+
+  // only alive during setup; the runtime does not need it afterwards
+  std::unique_ptr<xnn_subgraph, subgraph_deleter> subgraph_;
+  xnn_runtime_t runtime_ = nullptr;
+
+  size_t batch_ = 1;
+  std::vector<xnn_external_value> externals_;
+  uint32_t next_external_id_ = 0;
+  size_t activation_count_ = 0;
+
+  Calibration* observer_ = nullptr;
+  std::list<Frame<float>> observed_frames_;
+  std::vector<std::pair<const float*, size_t>> observed_;
+
+  const Calibration* calibration_ = nullptr;
+  std::list<std::vector<float>> quantized_scales_;
+  std::list<std::vector<int8_t>> quantized_weights_;
+  std::list<std::vector<int32_t>> quantized_biases_;
+};
+
+}
@@ -0,0 +1,442 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "xnnpack.h"
+#include "xnn_common.hpp"
+#include "conv2d.hpp"
+#include "depthwise_conv2d.hpp"
+#include "fc.hpp"
+#include "frame.hpp"
+#include "model_file.hpp"
+
+namespace rpi_rt::logic::shufflenet {
+
+/**
+ * A persistent XNNPACK weights cache, so packed weights survive restarts.
+ *
+ * XNNPACK repacks every weight tensor into its microkernel layout when an
+ * operator or runtime is created. Installed as XNNPackGuard::weights_cache()
+ * during setup, this cache hands out the packed weights it has and keeps
+ * the ones XNNPACK packs. save() writes them next to the model, load()
+ * maps them read only on the next start, and setup then only looks up.
+ *
+ * XNNPACK keys weights by address, which changes every run, so entries are
+ * stored by the offset of their kernel and bias in the ModelFile instead.
+ * Weights from anywhere else (a model directory, quantized or fp16 copies)
+ * are cached for this run only.
+ *
+ * The packed layout depends on the XNNPACK build and the CPU. A cache file
+ * records a fingerprint, the packing of a few probe operators, and a cache
+ * from another build or board, or for another model, is ignored.
+ *
+ * New entries go to an anonymous mapping reserved up front, whose
+ * addresses never move; the cache reports itself finalized from the start
+ * so operators can be set up while it still grows.
+ */
+class WeightsCache {
+public:
+  static constexpr uint32_t version = 1;
+  //! At least XNN_ALLOCATION_ALIGNMENT on every target
+  static constexpr size_t alignment = 64;
+  //! Address space for new entries; only the pages used take memory
+  static constexpr size_t default_capacity = size_t(64) << 20;
+
+  explicit WeightsCache(size_t capacity = default_capacity) : capacity_(capacity) {
+    void* grown = ::mmap(nullptr, capacity_, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (grown == MAP_FAILED) {
+      throw std::runtime_error("shufflenet: weights cache mmap failed");
+    }
+    grown_ = static_cast<uint8_t*>(grown);
+
+    provider_.context = this;
+    provider_.look_up = [](void* context, const xnn_weights_cache_look_up_key* key) {
+      return static_cast<WeightsCache*>(context)->look_up(*key);
+    };
+    provider_.reserve_space = [](void* context, size_t n) {
+      return static_cast<WeightsCache*>(context)->reserve_space(n);
+    };
+    provider_.look_up_or_insert = [](void* context, const xnn_weights_cache_look_up_key* key,
+        void* ptr, size_t size) {
+      return static_cast<WeightsCache*>(context)->look_up_or_insert(*key, ptr, size);
+    };
+    provider_.is_finalized = [](void*) {
+      return true;
+    };
+    provider_.offset_to_addr = [](void* context, size_t offset) {
+      return static_cast<WeightsCache*>(context)->offset_to_addr(offset);
+    };
+    provider_.delete_cache = [](void*) {
+      // owned by the WeightsCache, not by XNNPACK
+      return xnn_status_success;
+    };
+  }
+
+  ~WeightsCache() {
+    ::munmap(grown_, capacity_);
+    if (loaded_) {
+      ::munmap(const_cast<uint8_t*>(loaded_), loaded_size_);
+    }
+  }
+
+  WeightsCache(const WeightsCache&) = delete;
+  WeightsCache(WeightsCache&&) = delete;
+  WeightsCache& operator=(const WeightsCache&) = delete;
+  WeightsCache& operator=(WeightsCache&&) = delete;
+
+  //! To install with XNNPackGuard::weights_cache(), must outlive the operators
+  xnn_weights_cache_t provider() noexcept {
+    return &provider_;
+  }
+
+  /**
+   * Keys entries by their offset in model and maps the cache file at path
+   * if there is one for this model, build and board. Call before any
+   * operator is created with this cache.
+   *
+   * @returns Whether the cache file was used; a missing or stale one is
+   *          not an error, it's rebuilt by save().
+   */
+  bool load(const std::string& path, const ModelFile& model) {
+    assert(used_ == 0 && !loaded_);
+    model_ = &model;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(header_t))) {
+      ::close(fd);
+      return false;
+    }
+    size_t size = st.st_size;
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+      return false;
+    }
+    const auto* file = static_cast<const uint8_t*>(data);
+
+    header_t header;
+    std::memcpy(&header, file, sizeof(header));
+    bool valid = std::memcmp(header.magic, magic, sizeof(magic)) == 0
+      && header.version == version
+      && header.file_size == size
+      && header.model_checksum == model.checksum()
+      && header.fingerprint == fingerprint()
+      && header.blob_offset % alignment == 0
+      && header.blob_offset <= size
+      && sizeof(header_t) + header.count * sizeof(entry_t) <= header.blob_offset
+      && ModelFile::crc32(file + sizeof(header_t), size - sizeof(header_t)) == header.checksum;
+
+    const auto* entries = reinterpret_cast<const entry_t*>(file + sizeof(header_t));
+    size_t blob_size = size - header.blob_offset;
+    for (uint32_t i = 0; valid && i < header.count; i++) {
+      valid = entries[i].offset % alignment == 0 && entries[i].offset <= blob_size
+        && entries[i].size <= blob_size - entries[i].offset;
+    }
+    if (!valid) {
+      ::munmap(data, size);
+      return false;
+    }
+
+    loaded_ = file;
+    loaded_size_ = size;
+    loaded_blob_ = file + header.blob_offset;
+    loaded_bytes_ = blob_size;
+    for (uint32_t i = 0; i < header.count; i++) {
+      const auto& e = entries[i];
+      entries_[key_t{e.seed, e.kernel, e.bias}] = value_t{e.offset, e.size, true};
+    }
+    return true;
+  }
+
+  /**
+   * Writes the entries keyed by the model to path, if any were added since
+   * load(). The file is written aside and renamed into place.
+   *
+   * @returns Whether the file was written.
+   */
+  bool save(const std::string& path) {
+    if (!model_ || unsaved_ == 0) {
+      return false;
+    }
+
+    std::vector<entry_t> entries;
+    size_t blob_size = 0;
+    for (const auto& [key, value] : entries_) {
+      if (value.persistent) {
+        entries.push_back(entry_t{key.kernel, key.bias, blob_size, value.size, key.seed, 0});
+        blob_size = align(blob_size + value.size);
+      }
+    }
+
+    size_t blob_offset = align(sizeof(header_t) + entries.size() * sizeof(entry_t));
+    std::vector<uint8_t> file(blob_offset + blob_size, 0);
+    std::memcpy(file.data() + sizeof(header_t), entries.data(), entries.size() * sizeof(entry_t));
+    size_t i = 0;
+    for (const auto& [key, value] : entries_) {
+      if (value.persistent) {
+        std::memcpy(file.data() + blob_offset + entries[i++].offset, offset_to_addr(value.offset), value.size);
+      }
+    }
+
+    header_t header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.count = entries.size();
+    header.file_size = file.size();
+    header.model_checksum = model_->checksum();
+    header.fingerprint = fingerprint();
+    header.blob_offset = blob_offset;
+    header.checksum = ModelFile::crc32(file.data() + sizeof(header_t), file.size() - sizeof(header_t));
+    std::memcpy(file.data(), &header, sizeof(header));
+
+    std::string tmp = path + ".tmp";
+    {
+      std::ofstream ofs{tmp, std::ios::binary | std::ios::trunc};
+      ofs.write(reinterpret_cast<const char*>(file.data()), file.size());
+      if (!ofs.flush()) {
+        throw std::runtime_error("shufflenet: failed to write " + tmp);
+      }
+    }
+    std::filesystem::rename(tmp, path);
+    unsaved_ = 0;
+    return true;
+  }
+
+  //! Weights XNNPACK did not have to pack
+  size_t hits() const noexcept {
+    return hits_;
+  }
+
+  //! Weights XNNPACK packed
+  size_t misses() const noexcept {
+    return misses_;
+  }
+
+  /**
+   * Identifies the packed layout of this XNNPACK build on this CPU: the
+   * CRC-32 of the weights packed for a few probe operators, and the
+   * hardware capabilities.
+   */
+  static uint32_t fingerprint() {
+    static const uint32_t value = [] {
+      WeightsCache probe;
+      auto& guard = XNNPackGuard::instance();
+      auto previous = guard.weights_cache();
+      guard.weights_cache(probe.provider());
+      try {
+        Frame<float> input{1, 4, 4, 16};
+        Frame<float> output{1, 4, 4, 16};
+        Frame<float> fc_input{1, 1, 1, 16};
+        Frame<float> fc_output{1, 1, 1, 4};
+
+        Conv2D<float>::Params conv_params{16, 1, 1, 16};
+        conv_params.add_bias();
+        fill(conv_params.data(), conv_params.size());
+        fill(conv_params.bias().data(), conv_params.bias().size());
+        Conv2D<float> conv;
+        conv.setup(input, output, conv_params);
+
+        DepthwiseConv2D<float>::Params dwconv_params{16, 3, 3};
+        dwconv_params.padding_width(1);
+        dwconv_params.padding_height(1);
+        dwconv_params.add_bias();
+        fill(dwconv_params.data(), dwconv_params.size());
+        fill(dwconv_params.bias().data(), dwconv_params.bias().size());
+        DepthwiseConv2D<float> dwconv;
+        dwconv.setup(input, output, dwconv_params);
+
+        Fc<float>::Params fc_params{4, 16};
+        fc_params.add_bias();
+        fill(fc_params.data(), fc_params.size());
+        fill(fc_params.bias().data(), fc_params.bias().size());
+        Fc<float> fc;
+        fc.setup(fc_input, fc_output, fc_params);
+      } catch (...) {
+        guard.weights_cache(previous);
+        throw;
+      }
+      guard.weights_cache(previous);
+
+      uint64_t hwcaps[] = {::getauxval(AT_HWCAP), ::getauxval(AT_HWCAP2), sizeof(void*)};
+      std::vector<uint8_t> bytes(probe.grown_, probe.grown_ + probe.used_);
+      bytes.insert(bytes.end(), reinterpret_cast<const uint8_t*>(hwcaps),
+          reinterpret_cast<const uint8_t*>(hwcaps) + sizeof(hwcaps));
+      return ModelFile::crc32(bytes.data(), bytes.size());
+    }();
+    return value;
+  }
+
+private:
+  static constexpr char magic[8] = {'S', 'I', 'R', 'E', 'N', 'X', 'W', 'C'};
+  //! XNNPACK's XNN_CACHE_NOT_FOUND
+  static constexpr size_t not_found = SIZE_MAX;
+  //! Marks an id that is an address, only valid for this run
+  static constexpr uint64_t address_bit = uint64_t(1) << 63;
+  static constexpr uint64_t no_bias = UINT64_MAX;
+
+  struct header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t file_size;
+    uint32_t checksum;        //!< CRC-32 of everything after the header
+    uint32_t model_checksum;  //!< ModelFile::checksum() of the model
+    uint32_t fingerprint;
+    uint32_t reserved0;
+    uint64_t blob_offset;
+    uint8_t reserved[16];
+  };
+  static_assert(sizeof(header_t) == 64);
+
+  struct entry_t {
+    uint64_t kernel;  //!< offset in the model file
+    uint64_t bias;    //!< offset in the model file, or no_bias
+    uint64_t offset;  //!< in the blob
+    uint64_t size;
+    uint32_t seed;
+    uint32_t reserved;
+  };
+  static_assert(sizeof(entry_t) == 40);
+
+  struct key_t {
+    uint32_t seed;
+    uint64_t kernel;
+    uint64_t bias;
+
+    bool operator==(const key_t& other) const noexcept {
+      return seed == other.seed && kernel == other.kernel && bias == other.bias;
+    }
+  };
+
+  struct key_hash_t {
+    size_t operator()(const key_t& key) const noexcept {
+      uint64_t h = key.seed;
+      h = h * 0x9e3779b97f4a7c15ull ^ key.kernel;
+      h = h * 0x9e3779b97f4a7c15ull ^ key.bias;
+      return static_cast<size_t>(h ^ (h >> 32));
+    }
+  };
+
+  struct value_t {
+    size_t offset;  //!< for offset_to_addr()
+    size_t size;
+    bool persistent;
+  };
+
+  static size_t align(size_t offset) noexcept {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  static void fill(float* data, size_t size) noexcept {
+    for (size_t i = 0; i < size; i++) {
+      data[i] = static_cast<float>(i % 13) - 6.0f;
+    }
+  }
+
+  // the offset in the model, or the address if it isn't in there
+  uint64_t id(const void* ptr, bool& persistent) const noexcept {
+    if (!ptr) {
+      return no_bias;
+    }
+    const auto* p = static_cast<const uint8_t*>(ptr);
+    if (model_ && p >= model_->data() && p < model_->data() + model_->bytes()) {
+      return p - model_->data();
+    }
+    persistent = false;
+    return reinterpret_cast<uintptr_t>(ptr) | address_bit;
+  }
+
+  key_t key(const xnn_weights_cache_look_up_key& cache_key, bool& persistent) const noexcept {
+    persistent = true;
+    return key_t{cache_key.seed, id(cache_key.kernel, persistent), id(cache_key.bias, persistent)};
+  }
+
+  size_t look_up(const xnn_weights_cache_look_up_key& cache_key) {
+    bool persistent;
+    auto it = entries_.find(key(cache_key, persistent));
+    if (it == entries_.end()) {
+      return not_found;
+    }
+    hits_++;
+    return it->second.offset;
+  }
+
+  void* reserve_space(size_t n) {
+    if (n > capacity_ - used_) {
+      return nullptr;
+    }
+    return grown_ + used_;
+  }
+
+  size_t look_up_or_insert(const xnn_weights_cache_look_up_key& cache_key, void* ptr, size_t size) {
+    bool persistent;
+    auto k = key(cache_key, persistent);
+    auto it = entries_.find(k);
+    if (it != entries_.end()) {
+      // packed again, the reserved space is simply reused
+      hits_++;
+      return it->second.offset;
+    }
+    if (ptr != grown_ + used_ || size > capacity_ - used_) {
+      // not what reserve_space() handed out
+      return not_found;
+    }
+
+    size_t offset = loaded_bytes_ + used_;
+    entries_[k] = value_t{offset, size, persistent};
+    used_ = std::min(capacity_, align(used_ + size));
+    misses_++;
+    if (persistent) {
+      unsaved_++;
+    }
+    return offset;
+  }
+
+  void* offset_to_addr(size_t offset) const noexcept {
+    if (offset < loaded_bytes_) {
+      return const_cast<uint8_t*>(loaded_blob_ + offset);
+    }
+    return grown_ + (offset - loaded_bytes_);
+  }
+
+  xnn_weights_cache_provider provider_{};
+  const ModelFile* model_ = nullptr;
+  std::unordered_map<key_t, value_t, key_hash_t> entries_;
+
+  // the file load() mapped, its entries come first in the offsets
+  const uint8_t* loaded_ = nullptr;
+  size_t loaded_size_ = 0;
+  const uint8_t* loaded_blob_ = nullptr;
+  size_t loaded_bytes_ = 0;
+
+  // entries added this run
+  uint8_t* grown_ = nullptr;
+  size_t capacity_ = 0;
+  size_t used_ = 0;
+  size_t unsaved_ = 0;
+
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+};
+
+}
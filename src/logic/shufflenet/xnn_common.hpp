@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <cassert>
+#include <cstdint>
 #include <stdexcept>
+#include <vector>
 
 #include "xnnpack.h"
+#include "pthreadpool.h"
 
 namespace rpi_rt::logic::shufflenet {
 
@@ -14,50 +19,149 @@ public:
     return guard;
   }
 
+  // the process-wide threadpool passed to every reshape and run call
+  pthreadpool_t threadpool() const noexcept {
+    return threadpool_;
+  }
+
+  size_t threads() const noexcept {
+    return threadpool_ ? pthreadpool_get_threads_count(threadpool_) : 1;
+  }
+
+  // Recreates the threadpool with the given thread count, 0 for one per core.
+  //
+  // Operators pick their tiling at reshape time and runtimes keep the pool,
+  // so this throws while any operator or runtime exists, unless the count
+  // is the current one, which does nothing.
+  void threads(size_t count) {
+    if (count == threads_requested_ || (count && count == threads())) {
+      return;
+    }
+    if (users_ != 0) {
+      throw std::runtime_error("XNNPackGuard: thread count changed while operators exist");
+    }
+    pthreadpool_destroy(threadpool_);
+    threadpool_ = nullptr;
+    create_threadpool(count);
+  }
+
+  // counts the operators and runtimes created with the threadpool, every
+  // retain() after a create, a release() after its delete
+  void retain() noexcept {
+    users_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void release() noexcept {
+    users_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // the weights cache passed to every operator created from now on, null
+  // to pack weights privately; must outlive those operators
+  xnn_weights_cache_t weights_cache() const noexcept {
+    return weights_cache_;
+  }
+
+  void weights_cache(xnn_weights_cache_t cache) noexcept {
+    weights_cache_ = cache;
+  }
+
 private:
   XNNPackGuard() {
     xnn_status status = xnn_initialize(nullptr);
     if (status != xnn_status_success) {
       throw std::runtime_error("xnn_initialize");
     }
+    create_threadpool(0);
   }
 
   ~XNNPackGuard() {
+    pthreadpool_destroy(threadpool_);
     (void)xnn_deinitialize();
   }
+
+  void create_threadpool(size_t count) {
+    threads_requested_ = count;
+    // a single thread is better served by running on the caller
+    if (count == 1) {
+      return;
+    }
+    threadpool_ = pthreadpool_create(count);
+    if (!threadpool_) {
+      throw std::runtime_error("pthreadpool_create");
+    }
+  }
+
+  pthreadpool_t threadpool_ = nullptr;
+  size_t threads_requested_ = 0;
+  std::atomic<size_t> users_{0};
+  xnn_weights_cache_t weights_cache_ = nullptr;
 };
 
+// IEEE half precision storage; XNNPACK does the arithmetic
+struct Float16 {
+  uint16_t bits;
+};
+
+/**
+ * The weights or biases of an operator: owned, or a view of memory that
+ * outlives them, like a mapped ModelFile.
+ */
 template <class Elem>
-class Bias {
+class Weights {
 public:
-    Bias() {}
+    Weights() {}
 
-    Bias(size_t channels) {
-      resize(channels);
+    Weights(size_t size) {
+      resize(size);
     }
 
-    void resize(size_t channels) {
-      buffer_.resize(channels);
+    // owned again after a view()
+    void resize(size_t size) {
+      buffer_.resize(size);
+      size_ = size;
+      view_ = nullptr;
     }
 
-    size_t channels() const noexcept {
-      return buffer_.size();
+    // drops the own copy, data() then returns the size() elements at data
+    void view(const Elem* data) {
+      std::vector<Elem>().swap(buffer_);
+      view_ = data;
+    }
+
+    bool is_view() const noexcept {
+      return view_ != nullptr;
     }
 
     size_t size() const noexcept {
-      return channels();
+      return size_;
     }
 
     const Elem* data() const noexcept {
-      return buffer_.data();
+      return view_ ? view_ : buffer_.data();
     }
 
+    // to fill in owned weights
     Elem* data() noexcept {
+      assert(!view_);
       return buffer_.data();
     }
 
 private:
   std::vector<Elem> buffer_;
+  size_t size_ = 0;
+  const Elem* view_ = nullptr;
+};
+
+template <class Elem>
+class Bias : public Weights<Elem> {
+public:
+    Bias() {}
+
+    Bias(size_t channels) : Weights<Elem>(channels) {}
+
+    size_t channels() const noexcept {
+      return this->size();
+    }
 };
 
 }
@@ -1,6 +1,8 @@
 #include <chrono>
 #include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <fstream>
 #include <iterator>
@@ -16,9 +18,23 @@ namespace rpi_rt {
       visual_detection_result(float logit, float logit_threshold)
         : logit_(logit), logit_threshold_(logit_threshold)
       {}
-      visual_detection_result(float logit, float logit_threshold, Frame<uint8_t> frame, uint64_t frame_id)
-        : logit_(logit), logit_threshold_(logit_threshold), frame_(frame), frame_id_(frame_id)
-      {}
+      // only a fire keeps its frame for the attachment, as a copy: results
+      // wait in the alarm queues and must not hold on to capture buffers.
+      // A downscaled fire frame also asks the sensor for the next capture
+      // at full resolution
+      visual_detection_result(float logit, float logit_threshold, const Frame<uint8_t>& frame,
+          uint64_t frame_id, unsigned camera_id = 0,
+          const std::function<std::shared_future<Frame<uint8_t>> ()>& full_resolution = nullptr)
+        : logit_(logit), logit_threshold_(logit_threshold), frame_id_(frame_id),
+          camera_id_(camera_id)
+      {
+        if (has_fire()) {
+          frame_ = frame.clone();
+          if (full_resolution) {
+            full_frame_ = full_resolution();
+          }
+        }
+      }
       virtual ~visual_detection_result() {}
 
       virtual bool has_fire() override {
@@ -27,38 +43,86 @@ namespace rpi_rt {
 
       virtual std::string explain() override {
         std::ostringstream oss;
-        oss << "Visual LOGIT: " << logit_
+        oss << "Visual CAMERA: " << camera_id_
+          << " LOGIT: " << logit_
           << " THRESHOLD: " << logit_threshold_
           << (has_fire() ? " [FIRE]" : " [NO FIRE]");
         return oss.str();
       }
 
-      virtual std::vector<uint8_t> jpg_attachment() override {
-        if (frame_) {
-          std::vector<uint8_t> jpg_data;
-          jpg_data = jpeg_utils::write_to_mem(*frame_);
-          return jpg_data;
+      virtual std::shared_ptr<const std::vector<uint8_t>> jpg_attachment() override {
+        if (!frame_) {
+          return nullptr;
         }
-        return {};
+        // the alarms share this result, the first to ask encodes
+        std::call_once(jpg_once_, [this](){
+          jpg_ = std::make_shared<const std::vector<uint8_t>>(jpeg_utils::write_to_mem(attached_frame()));
+        });
+        return jpg_;
       }
 
       virtual uint64_t frame_id() const noexcept override {
         return frame_id_;
       }
 
+      virtual unsigned camera_id() const noexcept override {
+        return camera_id_;
+      }
+
     private:
+      // the full resolution capture unless the sensor closed or is late,
+      // the frame the model saw otherwise
+      const Frame<uint8_t>& attached_frame() {
+        if (full_frame_.valid() &&
+            full_frame_.wait_for(std::chrono::seconds{1}) == std::future_status::ready) {
+          try {
+            return full_frame_.get();
+          } catch (const std::future_error&) {
+          }
+        }
+        return *frame_;
+      }
+
       float logit_;
       float logit_threshold_;
-      uint64_t frame_id_ = 0;
       std::optional<Frame<uint8_t>> frame_ = std::nullopt;
+      std::shared_future<Frame<uint8_t>> full_frame_;
+      std::once_flag jpg_once_;
+      std::shared_ptr<const std::vector<uint8_t>> jpg_;
+      uint64_t frame_id_ = 0;
+      unsigned camera_id_ = 0;
   };
 
   void visual_classify_logic_t::process(uint64_t frame_id, const Frame<uint8_t>& frame) {
+    latency_assessment::trace_frames_scope_t trace_scope{&frame_id, &frame_id + 1,
+      [](uint64_t id) { return id; }};
     float logit = model_->process(frame);
     auto result = std::make_unique<visual_detection_result>(
         logit, logit_threshold_, frame, frame_id);
+    latency_assessment::report_timepoint(frame_id, latency_assessment::trace_stage_t::result);
     last_logit_ = logit;
     callback_(std::move(result));
   }
+
+  void visual_classify_logic_t::process_batch(const std::vector<camera_frame_t>& frames) {
+    std::vector<Frame<uint8_t>> inputs;
+    inputs.reserve(frames.size());
+    for (const auto& f : frames) {
+      inputs.push_back(f.frame);
+    }
+
+    // the model traces its steps for every frame of the batch
+    latency_assessment::trace_frames_scope_t trace_scope{frames.begin(), frames.end(),
+      [](const camera_frame_t& f) { return f.frame_id; }};
+    auto logits = model_->process_batch(inputs);
+    for (size_t i = 0; i < frames.size(); i++) {
+      auto result = std::make_unique<visual_detection_result>(
+          logits[i], logit_threshold_, frames[i].frame, frames[i].frame_id, frames[i].camera_id,
+          frames[i].full_resolution);
+      latency_assessment::report_timepoint(frames[i].frame_id, latency_assessment::trace_stage_t::result);
+      last_logit_ = logits[i];
+      callback_(std::move(result));
+    }
+  }
 }
 
@@ -0,0 +1,131 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency_trace.hpp"
+
+namespace rpi_rt::latency_assessment {
+
+namespace {
+  // appends the records of every thread to the trace file in the background
+  class trace_drainer_t {
+    public:
+      static trace_drainer_t& instance() {
+        static trace_drainer_t drainer;
+        return drainer;
+      }
+
+      detail::trace_ring_t& register_ring() {
+        std::unique_lock lg{mut_rings_};
+        rings_.push_back(std::make_unique<detail::trace_ring_t>(rings_.size()));
+        return *rings_.back();
+      }
+
+      void start(const std::string& path) {
+        std::unique_lock lg{mut_};
+        if (file_) {
+          throw std::runtime_error("latency trace already running");
+        }
+        file_ = std::fopen(path.c_str(), "wb");
+        if (!file_) {
+          throw std::runtime_error("cannot open latency trace file " + path);
+        }
+        const uint32_t header[2] = {trace_version, sizeof(trace_record_t)};
+        std::fwrite(trace_magic, sizeof(trace_magic), 1, file_);
+        std::fwrite(header, sizeof(header), 1, file_);
+
+        closing_ = false;
+        dropped_at_start_ = dropped();
+        thread_ = std::thread([this](){ loop(); });
+        detail::do_assessment_flag() = true;
+      }
+
+      uint64_t stop() {
+        detail::do_assessment_flag() = false;
+        {
+          std::unique_lock lg{mut_};
+          if (!file_) {
+            return 0;
+          }
+          closing_ = true;
+        }
+        cond_.notify_one();
+        thread_.join();
+
+        std::unique_lock lg{mut_};
+        // records pushed right before the flag went down
+        drain();
+        std::fclose(file_);
+        file_ = nullptr;
+        return dropped() - dropped_at_start_;
+      }
+
+    private:
+      trace_drainer_t() = default;
+
+      ~trace_drainer_t() {
+        stop();
+      }
+
+      void loop() {
+        std::unique_lock lg{mut_};
+        while (!closing_) {
+          cond_.wait_for(lg, std::chrono::milliseconds{100});
+          drain();
+        }
+      }
+
+      // with mut_ held
+      void drain() {
+        std::unique_lock lg{mut_rings_};
+        for (const auto& ring : rings_) {
+          ring->drain([this](const trace_record_t* records, size_t count) {
+            std::fwrite(records, sizeof(trace_record_t), count, file_);
+          });
+        }
+        std::fflush(file_);
+      }
+
+      uint64_t dropped() {
+        std::unique_lock lg{mut_rings_};
+        uint64_t dropped = 0;
+        for (const auto& ring : rings_) {
+          dropped += ring->dropped();
+        }
+        return dropped;
+      }
+
+      std::mutex mut_;
+      std::condition_variable cond_;
+      std::thread thread_;
+      std::FILE* file_ = nullptr;
+      bool closing_ = false;
+      uint64_t dropped_at_start_ = 0;
+
+      // rings live as long as the process, threads keep a pointer to theirs
+      std::mutex mut_rings_;
+      std::vector<std::unique_ptr<detail::trace_ring_t>> rings_;
+  };
+}
+
+namespace detail {
+  trace_ring_t& register_trace_ring() {
+    return trace_drainer_t::instance().register_ring();
+  }
+}
+
+  void begin_assessment(const std::string& path) {
+    trace_drainer_t::instance().start(path);
+  }
+
+  uint64_t end_assessment() {
+    return trace_drainer_t::instance().stop();
+  }
+
+}
@@ -33,7 +33,7 @@ public:
         setup();
         while (!closing_) {
             uint64_t frame_id = latency_assessment::make_frame_id();
-            latency_assessment::report_timepoint(frame_id);
+            latency_assessment::report_timepoint(frame_id, latency_assessment::trace_stage_t::capture);
 
             try {
                 uint8_t raw = read_adc_raw();
@@ -0,0 +1,219 @@
+#pragma once
+
+/*
+ * Converts packed capture buffers to RGB24 frames, downscaled to the model
+ * input in one pass on the capture thread, and at full resolution on a
+ * thread of its own for previews and alarm attachments.
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "avwrap.hpp"
+#include "frame.hpp"
+
+namespace rpi_rt {
+  class capture_scaler_t {
+    public:
+      /**
+       * @param fmt the packed pixel format of the capture buffers, e.g. YUYV
+       * @param stride the bytes per line of the capture buffers
+       * @param output_width if non-zero with output_height, the size convert()
+       *        downscales to, the full size otherwise
+       */
+      capture_scaler_t(AVPixelFormat fmt, size_t width, size_t height, size_t stride,
+          size_t output_width, size_t output_height,
+          std::chrono::milliseconds preview_interval)
+        : width_(width), height_(height), stride_(stride),
+          downscaling_(output_width && output_height),
+          preview_interval_(preview_interval) {
+        if (!downscaling_) {
+          output_width = width;
+          output_height = height;
+        }
+        // area averaging when downscaling a lot, it reads every source
+        // pixel once and doesn't alias like bilinear
+        sws_ctx_.reset(avwrap::sws_getContext_chk(
+              width, height, fmt,
+              output_width, output_height,
+              AV_PIX_FMT_RGB24, downscaling_ ? SWS_AREA : SWS_FAST_BILINEAR,
+              nullptr, nullptr, nullptr));
+        pool_.resize(output_height, output_width, 3);
+        if (downscaling_) {
+          full_pool_.resize(height, width, 3);
+          full_sws_ctx_.reset(avwrap::sws_getContext_chk(
+                width, height, fmt,
+                width, height,
+                AV_PIX_FMT_RGB24, SWS_FAST_BILINEAR,
+                nullptr, nullptr, nullptr));
+        }
+      }
+
+      ~capture_scaler_t() {
+        stop();
+      }
+
+      capture_scaler_t(const capture_scaler_t&) = delete;
+      capture_scaler_t& operator=(const capture_scaler_t&) = delete;
+
+      bool downscaling() const noexcept {
+        return downscaling_;
+      }
+
+      /**
+       * Sets the callback for full resolution previews, call before start().
+       */
+      void set_preview_callback(std::function<void (uint64_t frame_id, Frame<uint8_t>)> callback) {
+        preview_callback_ = std::move(callback);
+      }
+
+      /**
+       * Starts the full resolution thread, if downscaling.
+       */
+      void start() {
+        if (downscaling_ && !thread_.joinable()) {
+          thread_ = std::thread([this](){ full_loop(); });
+        }
+      }
+
+      /**
+       * Stops the full resolution thread once the buffer it borrowed is
+       * released. Captures still waited for are abandoned.
+       */
+      void stop() {
+        {
+          std::unique_lock lg{mut_};
+          closing_ = true;
+        }
+        cond_.notify_one();
+        if (thread_.joinable())
+          thread_.join();
+        std::unique_lock lg{mut_};
+        waiting_.clear();
+      }
+
+      /**
+       * Converts a capture buffer at the output size.
+       */
+      Frame<uint8_t> convert(const uint8_t* data) {
+        Frame<uint8_t> frame = pool_.acquire();
+        convert(sws_ctx_.get(), data, frame);
+        return frame;
+      }
+
+      /**
+       * Lends a capture buffer to the full resolution thread if a preview
+       * is due or a full resolution capture is waited for.
+       *
+       * @param release returns the buffer to the capture, called from the
+       *        full resolution thread once it is converted
+       * @return false if the buffer was not borrowed, the caller releases it
+       */
+      bool schedule(uint64_t frame_id, const uint8_t* data, std::function<void ()> release) {
+        if (!downscaling_)
+          return false;
+
+        auto now = std::chrono::steady_clock::now();
+        {
+          std::unique_lock lg{mut_};
+          // the thread is gone or going once closing, nobody would release it
+          if (closing_ || release_)
+            return false;
+          bool preview_due = preview_callback_ && now >= next_preview_;
+          if (!preview_due && waiting_.empty())
+            return false;
+          release_ = std::move(release);
+          frame_id_ = frame_id;
+          data_ = data;
+          preview_ = preview_due;
+          if (preview_due)
+            next_preview_ = now + preview_interval_;
+        }
+        cond_.notify_one();
+        return true;
+      }
+
+      /**
+       * Requests the next capture scheduled, at full resolution.
+       *
+       * @return an invalid future if not downscaling, convert() already
+       *         returns full resolution frames, or once stopped
+       */
+      std::shared_future<Frame<uint8_t>> capture_full_resolution() {
+        if (!downscaling_)
+          return {};
+        std::unique_lock lg{mut_};
+        if (closing_)
+          return {};
+        waiting_.emplace_back();
+        return waiting_.back().get_future().share();
+      }
+
+    private:
+      void convert(SwsContext* ctx, const uint8_t* data, Frame<uint8_t>& frame) {
+        const uint8_t *src_data[4] = { data, NULL, NULL, NULL };
+        int src_linesize[4] = { (int)stride_, 0, 0, 0 };
+        uint8_t *dst_data[4] = { frame.data(), NULL, NULL, NULL };
+        int dst_linesize[4] = { (int)(frame.width() * frame.channels()), 0, 0, 0 };
+        avwrap::sws_scale_chk(ctx, src_data, src_linesize, 0, height_, dst_data, dst_linesize);
+      }
+
+      void full_loop() {
+        std::unique_lock lg{mut_};
+        while (true) {
+          cond_.wait(lg, [this]{ return closing_ || release_; });
+          // a buffer lent before closing is still converted and released
+          if (!release_)
+            return;
+
+          // release_ stays set until done, schedule() lends nothing meanwhile
+          auto release = release_;
+          auto waiting = std::move(waiting_);
+          waiting_.clear();
+          bool preview = preview_;
+          lg.unlock();
+          Frame<uint8_t> frame = full_pool_.acquire();
+          convert(full_sws_ctx_.get(), data_, frame);
+          release();
+          for (auto& promise : waiting) {
+            promise.set_value(frame);
+          }
+          if (preview) {
+            preview_callback_(frame_id_, std::move(frame));
+          }
+          lg.lock();
+          release_ = nullptr;
+        }
+      }
+
+      size_t width_;
+      size_t height_;
+      size_t stride_;
+      bool downscaling_;
+      std::chrono::milliseconds preview_interval_;
+
+      avwrap::sws_context_ptr sws_ctx_; // to rgb24 at output size
+      avwrap::sws_context_ptr full_sws_ctx_; // to rgb24 at full size
+      FramePool<uint8_t> pool_;
+      FramePool<uint8_t> full_pool_;
+
+      std::function<void (uint64_t, Frame<uint8_t>)> preview_callback_;
+
+      // at most one buffer is lent to the thread at a time
+      std::thread thread_;
+      std::mutex mut_;
+      std::condition_variable cond_;
+      bool closing_ = false;
+      std::function<void ()> release_;
+      uint64_t frame_id_ = 0;
+      const uint8_t* data_ = nullptr;
+      bool preview_ = false;
+      std::chrono::steady_clock::time_point next_preview_;
+      std::vector<std::promise<Frame<uint8_t>>> waiting_;
+  };
+}
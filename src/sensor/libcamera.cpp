@@ -24,6 +24,7 @@
 
 #include "libcamera/libcamera.h"
 #include "avwrap.hpp"
+#include "capture_scaler.hpp"
 
 #include "sensor.hpp"
 #include "frame.hpp"
@@ -31,15 +32,14 @@
 namespace rpi_rt {
   class libcamera_sensor_t : public camera_sensor_t {
     public:
-      explicit libcamera_sensor_t(unsigned cam_index)
-        : cam_index_(cam_index) {}
+      explicit libcamera_sensor_t(const libcamera_config_t& cfg)
+        : cfg_(cfg) {}
 
       virtual ~libcamera_sensor_t() override {}
 
       virtual void run() override {
         std::unique_lock lg{mut_camera_};
         start_libcamera();
-        scaler_init();
         while(!closing_) {
           cond_camera_.wait_for(lg, std::chrono::milliseconds{500});
         }
@@ -49,6 +49,8 @@ namespace rpi_rt {
         {
           std::unique_lock lg{mut_camera_};
           closing_ = true;
+          if (scaler_)
+            scaler_->stop();
           stop_libcamera();
         }
         cond_camera_.notify_one();
@@ -58,46 +60,65 @@ namespace rpi_rt {
         callback_ = callback;
       }
 
+      virtual bool set_preview_callback(std::function<void (uint64_t frame_id, Frame<uint8_t>)> callback) override {
+        if (!downscaling()) {
+          return false;
+        }
+        preview_callback_ = callback;
+        return true;
+      }
+
+      virtual std::shared_future<Frame<uint8_t>> capture_full_resolution() override {
+        if (!scaler_)
+          return {};
+        return scaler_->capture_full_resolution();
+      }
+
     private:
+      bool downscaling() const noexcept {
+        return cfg_.output_width && cfg_.output_height;
+      }
+
       void request_complete(libcamera::Request *request) {
         if (request->status() == libcamera::Request::RequestCancelled)
           return;
 
-        const auto& buffers = request->buffers();
+        // YUYV should have only 1 plane, and a Viewfinder stream 1 buffer
+        const uint8_t* data = nullptr;
         for (auto buffer_pair : request->buffers()) {
-          auto buffer = buffer_pair.second;
-
-          // YUYV should have only 1 plane
-          auto planes = buffer->planes();
+          auto planes = buffer_pair.second->planes();
           if (planes.size() == 0)
             continue;
           if (planes.size() > 1) {
             std::cerr << "WARNING: got multi planes for YUYV" << std::endl;
           }
           const auto& plane = *planes.cbegin();
-          invoke_callback(plane);
+          assert(plane.length == stride_ * height_);
+          data = fd_ptrs_[plane.fd.get()] + plane.offset;
+        }
+        if (!data) {
+          requeue(request);
+          return;
         }
 
-        request->reuse(libcamera::Request::ReuseBuffers);
-        camera_->queueRequest(request);
-      }
-
-      void invoke_callback(const libcamera::FrameBuffer::Plane& plane) {
         uint64_t frame_id = latency_assessment::make_frame_id();
-        latency_assessment::report_timepoint(frame_id);
+        latency_assessment::report_timepoint(frame_id, latency_assessment::trace_stage_t::capture);
 
-        Frame<uint8_t> frame{height_, width_, 3};
+        // the full resolution thread reads the buffer concurrently and
+        // requeues the request once done
+        bool deferred = scaler_->schedule(frame_id, data, [this, request](){ requeue(request); });
 
-        const uint8_t* data = fd_ptrs_[plane.fd.get()] + plane.offset;
-        const size_t size = plane.length;
-
-        assert(size == stride_ * height_);
-        const uint8_t *src_data[4] = { data, NULL, NULL, NULL };
-        int src_linesize[4] = { (int)stride_, 0, 0, 0 };
-        uint8_t *dst_data[4] = { frame.data(), NULL, NULL, NULL };
-        int dst_linesize[4] = { (int)(frame.width() * frame.channels()), 0, 0, 0 };
-        avwrap::sws_scale_chk(sws_ctx_.get(), src_data, src_linesize, 0, height_, dst_data, dst_linesize); 
+        Frame<uint8_t> frame = scaler_->convert(data);
+        latency_assessment::report_timepoint(frame_id, latency_assessment::trace_stage_t::converted);
         callback_(frame_id, std::move(frame));
+
+        if (!deferred)
+          requeue(request);
+      }
+
+      void requeue(libcamera::Request *request) {
+        request->reuse(libcamera::Request::ReuseBuffers);
+        camera_->queueRequest(request);
       }
 
       void start_libcamera() {
@@ -115,10 +136,10 @@ namespace rpi_rt {
         if (cm_->cameras().empty())
           throw std::runtime_error("libcamera_sensor_t: no cameras identified");
 
-        if (cam_index_ >= cm_->cameras().size())
+        if (cfg_.cam_index >= cm_->cameras().size())
           throw std::runtime_error("libcamera_sensor_t: camera index out of range");
 
-        std::string camera_id = cm_->cameras()[cam_index_]->id();
+        std::string camera_id = cm_->cameras()[cfg_.cam_index]->id();
         std::cout << "Using camera : " << camera_id << std::endl;
         camera_ = cm_->get(camera_id);
         camera_->acquire();
@@ -140,6 +161,12 @@ namespace rpi_rt {
         if (ret < 0)
           throw std::runtime_error("libcamera_sensor_t: stream config failed");
 
+        scaler_ = std::make_unique<capture_scaler_t>(AV_PIX_FMT_YUYV422, width_, height_, stride_,
+            cfg_.output_width, cfg_.output_height,
+            std::chrono::milliseconds{cfg_.preview_interval_ms});
+        scaler_->set_preview_callback(preview_callback_);
+        scaler_->start();
+
         allocator_ = std::make_unique<libcamera::FrameBufferAllocator>(camera_);
         for (auto &cfg : *config_) {
           int ret = allocator_->allocate(cfg.stream());
@@ -199,16 +226,9 @@ namespace rpi_rt {
         fd_ptrs_[fd] = data;
       }
 
-      void scaler_init() {
-        sws_ctx_.reset(avwrap::sws_getContext_chk(
-              width_, height_, AV_PIX_FMT_YUYV422,
-              width_, height_,
-              AV_PIX_FMT_RGB24, SWS_FAST_BILINEAR,
-              nullptr, nullptr, nullptr));
-      }
-
-      const unsigned cam_index_ = 0;
+      const libcamera_config_t cfg_;
       std::function<void (uint64_t, Frame<uint8_t>)> callback_;
+      std::function<void (uint64_t, Frame<uint8_t>)> preview_callback_;
       std::atomic<bool> closing_ = ATOMIC_VAR_INIT(false);
       size_t height_ = 0;
       size_t width_ = 0;
@@ -227,11 +247,11 @@ namespace rpi_rt {
       std::mutex mut_camera_;
       std::condition_variable cond_camera_;
 
-      avwrap::sws_context_ptr sws_ctx_; // for yuyv422 -> rgb24
+      std::unique_ptr<capture_scaler_t> scaler_;
   };
 
-  std::shared_ptr<camera_sensor_t> create_libcamera_sensor(unsigned cam_index) {
-    return std::make_shared<libcamera_sensor_t>(cam_index);
+  std::shared_ptr<camera_sensor_t> create_libcamera_sensor(const libcamera_config_t& cfg) {
+    return std::make_shared<libcamera_sensor_t>(cfg);
   }
 
 }
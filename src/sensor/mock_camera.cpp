@@ -107,6 +107,7 @@ namespace rpi_rt {
               AV_PIX_FMT_RGB24, SWS_FAST_BILINEAR,
               nullptr, nullptr, nullptr));
         dst_frame_.reset(avwrap::av_frame_alloc_chk());
+        pool_.resize(height_, width_, 3);
       }
 
       void seek_begin() {
@@ -117,9 +118,9 @@ namespace rpi_rt {
 
       void invoke_callback() {
         uint64_t frame_id = latency_assessment::make_frame_id();
-        latency_assessment::report_timepoint(frame_id);
+        latency_assessment::report_timepoint(frame_id, latency_assessment::trace_stage_t::capture);
 
-        Frame<uint8_t> frame{height_, width_, 3};
+        Frame<uint8_t> frame = pool_.acquire();
 
         const uint8_t* data = dst_frame_->buf[0]->data;
         size_t sz = static_cast<size_t>(
@@ -147,6 +148,7 @@ namespace rpi_rt {
       std::atomic<bool> closing_ = ATOMIC_VAR_INIT(false);
       size_t height_ = 0;
       size_t width_ = 0;
+      FramePool<uint8_t> pool_;
   };
 
   std::shared_ptr<camera_sensor_t> create_mock_camera_sensor(const std::string& filename) {
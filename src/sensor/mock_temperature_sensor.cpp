@@ -24,7 +24,7 @@ namespace rpi_rt {
         while (!closing_) {
           std::this_thread::sleep_for(std::chrono::milliseconds{500});
           uint64_t frame_id = latency_assessment::make_frame_id();
-          latency_assessment::report_timepoint(frame_id);
+          latency_assessment::report_timepoint(frame_id, latency_assessment::trace_stage_t::capture);
           report_celsius_(frame_id, mock_data[i_mock++]);
           i_mock %= mock_data.size();
         }
@@ -9,6 +9,9 @@
 #include <cstring>
 #include <map>
 #include <cassert>
+#include <mutex>
+#include <condition_variable>
+#include <iostream>
 
 #include <fcntl.h>
 #include <errno.h>
@@ -26,7 +29,7 @@ namespace rpi_rt {
   class v4l2_camera_sensor_t : public camera_sensor_t {
     public:
       explicit v4l2_camera_sensor_t(const std::string& device)
-        : device_(device) {}
+        : device_(device), queue_(std::make_shared<buffer_queue_t>()) {}
 
       virtual ~v4l2_camera_sensor_t() override {}
 
@@ -45,10 +48,12 @@ namespace rpi_rt {
         stream_on();
 
         while (!closing_) {
+          // every buffer may still be viewed by frames further down
+          if (!wait_for_queued_buffer())
+            continue;
           wait_for_frame();
           unsigned index = dqbuf();
           invoke_callback(buffers_[index]);
-          qbuf(index);
         }
 
         stream_off();
@@ -69,11 +74,21 @@ namespace rpi_rt {
         size_t size = 0;
       };
 
+      // shared with the frames handed out, which may outlive the sensor
+      struct buffer_queue_t {
+        int fd = -1;
+        bool streaming = false;
+        size_t queued = 0;
+        std::mutex mut;
+        std::condition_variable cond;
+      };
+
       void open(const std::string& dev_name) {
         fd_ = v4l2_open(dev_name.c_str(), O_RDWR | O_NONBLOCK, 0);
         if (fd_ < 0) {
           throw std::runtime_error("v4l2_open failed");
         }
+        queue_->fd = fd_;
       }
 
       void xioctl(int request, void *arg)
@@ -143,22 +158,60 @@ namespace rpi_rt {
       }
 
       void qbuf(unsigned index) {
+        std::unique_lock lg{queue_->mut};
         v4l2_buffer buf;
         do_buf_xioctl(VIDIOC_QBUF, index, buf);
+        queue_->queued++;
       }
 
       unsigned dqbuf() {
+        std::unique_lock lg{queue_->mut};
         v4l2_buffer buf;
         do_buf_xioctl(VIDIOC_DQBUF, 0, buf);
+        queue_->queued--;
         return buf.index;
       }
 
+      // called by the deleter of the last frame viewing the buffer, on
+      // whichever thread that is, so it must not throw
+      static void release_buffer(buffer_queue_t& queue, unsigned index) noexcept {
+        std::unique_lock lg{queue.mut};
+        if (!queue.streaming)
+          return;
+
+        v4l2_buffer buf;
+        std::memset(&buf, 0, sizeof(buf));
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = index;
+        if (v4l2_ioctl(queue.fd, VIDIOC_QBUF, &buf) == -1) {
+          std::cerr << "WARNING: v4l2 qbuf failed: " << std::strerror(errno) << std::endl;
+          return;
+        }
+        queue.queued++;
+        queue.cond.notify_one();
+      }
+
+      bool wait_for_queued_buffer() {
+        std::unique_lock lg{queue_->mut};
+        return queue_->cond.wait_for(lg, std::chrono::milliseconds{500}, [this]{
+          return queue_->queued > 0;
+        });
+      }
+
       void stream_on() {
+        std::unique_lock lg{queue_->mut};
         v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         xioctl(VIDIOC_STREAMON, &type);
+        queue_->streaming = true;
       }
 
       void stream_off() {
+        // the driver takes all buffers back, frames still viewing them
+        // keep the mapping but are not requeued
+        std::unique_lock lg{queue_->mut};
+        queue_->streaming = false;
+        queue_->queued = 0;
         v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         xioctl(VIDIOC_STREAMOFF, &type);
       }
@@ -184,13 +237,14 @@ namespace rpi_rt {
 
       void invoke_callback(const mmap_buffer_t& buffer) {
         uint64_t frame_id = latency_assessment::make_frame_id();
-        latency_assessment::report_timepoint(frame_id);
-
-        Frame<uint8_t> frame{height_, width_, 3};
-
-        assert(buffer.size >= frame.size());
-        std::memcpy(frame.data(), buffer.data, frame.size());
-        callback_(frame_id, std::move(frame));
+        latency_assessment::report_timepoint(frame_id, latency_assessment::trace_stage_t::capture);
+
+        assert(buffer.size >= height_ * width_ * 3);
+        std::shared_ptr<uint8_t> data{buffer.data,
+          [queue = queue_, index = buffer.index](uint8_t*) {
+            release_buffer(*queue, index);
+          }};
+        callback_(frame_id, Frame<uint8_t>{height_, width_, 3, std::move(data)});
       }
 
       const std::string device_ = "/dev/video0";
@@ -200,6 +254,7 @@ namespace rpi_rt {
       size_t width_ = 0;
       std::map<unsigned, mmap_buffer_t> buffers_;
       int fd_ = -1;
+      std::shared_ptr<buffer_queue_t> queue_;
 
       static constexpr size_t buffer_count_ = 10;
   };
@@ -0,0 +1,311 @@
+#include "catch2/catch_test_macros.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <string>
+#include <iostream>
+#include <vector>
+
+#include "frame.hpp"
+#include "testdata.hpp"
+#include "src/logic/shufflenet/depthwise_conv2d.hpp"
+#include "src/logic/shufflenet/maxpool2d.hpp"
+#include "src/logic/shufflenet/fc.hpp"
+#include "src/logic/shufflenet/global_average_pool2d.hpp"
+#include "src/logic/shufflenet/conv2d.hpp"
+#include "src/logic/shufflenet/shuffle.hpp"
+#include "src/logic/shufflenet/branch1.hpp"
+#include "src/logic/shufflenet/branch2.hpp"
+#include "src/logic/shufflenet/inverted_residual.hpp"
+#include "src/logic/shufflenet/model.hpp"
+#include "src/logic/shufflenet/preprocess.hpp"
+
+// Times each kernel on its own, with the shapes and tensors of
+// test_shufflenet.cpp. Not run by ctest, run bench_shufflenet directly,
+// optionally with Catch2 tags, e.g. bench_shufflenet "[kernels]".
+
+/**
+ * Prints ns per call and the GB/s that makes for the given bytes, the
+ * median of 10 timed batches. Batches grow until one takes 20ms, so
+ * fast kernels aren't dominated by clock reads.
+ */
+template<class Fn>
+void bench(const std::string& name, uint64_t bytes, Fn&& fn) {
+  using clock = std::chrono::steady_clock;
+
+  for (int i = 0; i < 3; i++) {
+    fn();
+  }
+
+  size_t iterations = 1;
+  while (true) {
+    auto begin = clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      fn();
+    }
+    if (clock::now() - begin >= std::chrono::milliseconds(20))
+      break;
+    iterations *= 2;
+  }
+
+  std::vector<double> samples;
+  for (int s = 0; s < 10; s++) {
+    auto begin = clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+      fn();
+    }
+    double ns = std::chrono::duration<double, std::nano>(clock::now() - begin).count();
+    samples.push_back(ns / iterations);
+  }
+  std::sort(samples.begin(), samples.end());
+  double ns_per_op = samples[samples.size() / 2];
+
+  auto flags = std::cout.flags();
+  std::cout << std::left << std::setw(32) << name << std::right << std::fixed
+    << std::setprecision(0) << std::setw(12) << ns_per_op << " ns/op"
+    << std::setprecision(2) << std::setw(10) << bytes / ns_per_op << " GB/s" << std::endl;
+  std::cout.flags(flags);
+
+  CHECK(ns_per_op > 0);
+}
+
+// composites don't report a cost, count the data they take and give
+template<class Elem>
+uint64_t io_bytes(const rpi_rt::Frame<Elem>& input, const rpi_rt::Frame<Elem>& output) {
+  return rpi_rt::logic::shufflenet::frame_bytes(input) + rpi_rt::logic::shufflenet::frame_bytes(output);
+}
+
+TEST_CASE("Maxpool2D", "[shufflenet][kernels]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Maxpool2D;
+
+  Frame<float> input_frame(112, 112, 24);
+  Frame<float> output_frame(56, 56, 24);
+  fill_testdata(input_frame, "maxpool_input");
+
+  Maxpool2D<float>::Params params;
+  params.width(3);
+  params.height(3);
+  params.stride_width(2);
+  params.stride_height(2);
+  params.padding_width(1);
+  params.padding_height(1);
+  params.dilation_width(1);
+  params.dilation_height(1);
+
+  Maxpool2D<float> maxpool2d;
+  maxpool2d.setup(input_frame, output_frame, params);
+  bench("Maxpool2D 112x112x24", maxpool2d.cost().bytes, [&]{ maxpool2d.forward(); });
+}
+
+TEST_CASE("GlobalAveragePool2D", "[shufflenet][kernels]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::GlobalAveragePool2D;
+
+  Frame<float> input_frame(7, 7, 64);
+  Frame<float> output_frame(1, 1, 64);
+  fill_testdata(input_frame, "mean_input");
+
+  GlobalAveragePool2D<float> pool;
+  pool.setup(input_frame, output_frame);
+  bench("GlobalAveragePool2D 7x7x64", pool.cost().bytes, [&]{ pool.forward(); });
+}
+
+TEST_CASE("Fc", "[shufflenet][kernels]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Fc;
+
+  Frame<float> input_frame(1, 1, 64);
+  Frame<float> output_frame(1, 1, 1);
+  fill_testdata(input_frame, "fc_input");
+
+  Fc<float>::Params params(1, 64);
+  params.add_bias();
+  auto weight_data = load_testdata("fc_weight");
+  auto bias_data = load_testdata("fc_bias");
+  std::copy(weight_data.begin(), weight_data.end(), params.data());
+  std::copy(bias_data.begin(), bias_data.end(), params.bias().data());
+
+  Fc<float> fc;
+  fc.setup(input_frame, output_frame, params);
+  bench("Fc 64->1", fc.cost().bytes, [&]{ fc.forward(); });
+}
+
+TEST_CASE("Conv2D", "[shufflenet][kernels]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Conv2D;
+
+  Frame<float> input_frame(56, 56, 24);
+  Frame<float> output_frame(56, 56, 24);
+  fill_testdata(input_frame, "fused_batchnorm_input");
+
+  Conv2D<float>::Params params(24, 1, 1, 24);
+  params.add_bias();
+  params.relu(true);
+  auto weight_data = load_testdata("fused_batchnorm_weight");
+  auto bias_data = load_testdata("fused_batchnorm_bias");
+  std::copy(weight_data.begin(), weight_data.end(), params.data());
+  std::copy(bias_data.begin(), bias_data.end(), params.bias().data());
+
+  Conv2D<float> conv2d;
+  conv2d.setup(input_frame, output_frame, params);
+  bench("Conv2D 1x1 56x56x24", conv2d.cost().bytes, [&]{ conv2d.forward(); });
+}
+
+TEST_CASE("DepthwiseConv2D", "[shufflenet][kernels]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::DepthwiseConv2D;
+
+  Frame<float> input_frame(56, 56, 24);
+  Frame<float> output_frame(28, 28, 24);
+  fill_testdata(input_frame, "depthwise_conv2d_input");
+
+  DepthwiseConv2D<float>::Params params(24, 3, 3);
+  params.padding_width(1);
+  params.padding_height(1);
+  params.stride_width(2);
+  params.stride_height(2);
+  auto weight_data = load_testdata("depthwise_conv2d_weight");
+  std::copy(weight_data.begin(), weight_data.end(), params.data());
+
+  DepthwiseConv2D<float> conv2d;
+  conv2d.setup(input_frame, output_frame, params);
+  bench("DepthwiseConv2D 3x3/2 56x56x24", conv2d.cost().bytes, [&]{ conv2d.forward(); });
+}
+
+TEST_CASE("Shuffle", "[shufflenet][kernels]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Shuffle;
+
+  Frame<float> input_a(28, 28, 24);
+  Frame<float> input_b(28, 28, 24);
+  Frame<float> output_frame(28, 28, 48);
+  std::fill(input_a.data(), input_a.data() + input_a.size(), 1.0f);
+  std::fill(input_b.data(), input_b.data() + input_b.size(), 2.0f);
+
+  Shuffle<float> shuffle;
+  shuffle.setup(input_a, input_b, output_frame);
+  bench("Shuffle 28x28x48", shuffle.cost().bytes, [&]{ shuffle.forward(); });
+
+  // the first half read in place, as in blocks without branch1
+  Frame<float> strided_output(28, 28, 48);
+  Shuffle<float> strided;
+  strided.setup(output_frame, input_b, strided_output);
+  bench("Shuffle 28x28x48 in place", strided.cost().bytes, [&]{ strided.forward(); });
+}
+
+TEST_CASE("Branch1Demo", "[shufflenet][branchs]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Branch1;
+
+  Frame<float> input_frame(56, 56, 24);
+  Frame<float> output_frame(28, 28, 24);
+  fill_testdata(input_frame, "demo_x1_input");
+
+  Branch1<float>::Params params(48, 24, 2);
+  for (const char* name : {"w0", "w1", "b0", "b1"}) {
+    auto data = load_testdata(std::string("demo_x1") + name);
+    std::copy(data.begin(), data.end(), params.data(name[0], name[1]));
+  }
+
+  Branch1<float> x1;
+  x1.setup(input_frame, output_frame, params);
+  bench("Branch1 56x56x24", io_bytes(input_frame, output_frame), [&]{ x1.forward(); });
+}
+
+TEST_CASE("Branch2Demo", "[shufflenet][branchs]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Branch2;
+
+  Frame<float> input_frame(56, 56, 24);
+  Frame<float> output_frame(28, 28, 24);
+  fill_testdata(input_frame, "demo_x2_input");
+
+  Branch2<float>::Params params(48, 24, 2);
+  for (const char* name : {"w0", "w1", "w2", "b0", "b1", "b2"}) {
+    auto data = load_testdata(std::string("demo_x2") + name);
+    std::copy(data.begin(), data.end(), params.data(name[0], name[1]));
+  }
+
+  Branch2<float> x2;
+  x2.setup(input_frame, output_frame, params);
+  bench("Branch2 56x56x24", io_bytes(input_frame, output_frame), [&]{ x2.forward(); });
+}
+
+TEST_CASE("InvertedResidualDemo", "[shufflenet][repeats]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::InvertedResidual;
+
+  Frame<float> input_frame(56, 56, 24);
+  Frame<float> output_frame(28, 28, 48);
+  fill_testdata(input_frame, "demo_input");
+
+  InvertedResidual<float>::Params params(48, 24, 2);
+  for (const char* name : {"1w0", "1w1", "1b0", "1b1", "2w0", "2w1", "2w2", "2b0", "2b1", "2b2"}) {
+    auto data = load_testdata(std::string("demo_x") + name);
+    std::copy(data.begin(), data.end(), params.data(name[0], name[1], name[2]));
+  }
+
+  InvertedResidual<float> r;
+  r.setup(input_frame, output_frame, params);
+  bench("InvertedResidual/2 56x56x24", io_bytes(input_frame, output_frame), [&]{ r.forward(); });
+}
+
+TEST_CASE("InvertedResidualChunkingDemo", "[shufflenet][repeats]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::InvertedResidual;
+
+  Frame<float> input_frame(28, 28, 48);
+  Frame<float> output_frame(28, 28, 48);
+  fill_testdata(input_frame, "chunking_input");
+
+  InvertedResidual<float>::Params params(48, 48, 1);
+  for (const char* name : {"2w0", "2w1", "2w2", "2b0", "2b1", "2b2"}) {
+    auto data = load_testdata(std::string("chunking_x") + name);
+    std::copy(data.begin(), data.end(), params.data(name[0], name[1], name[2]));
+  }
+
+  InvertedResidual<float> r;
+  r.setup(input_frame, output_frame, params);
+  bench("InvertedResidual/1 28x28x48", io_bytes(input_frame, output_frame), [&]{ r.forward(); });
+}
+
+TEST_CASE("Preprocess", "[shufflenet][preprocess]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Preprocess;
+
+  // a camera frame, not yet downscaled
+  Frame<uint8_t> input_frame(480, 640, 3);
+  for (size_t i = 0; i < input_frame.size(); i++) {
+    input_frame.data()[i] = static_cast<uint8_t>(i * 7);
+  }
+  Frame<float> output_frame(224, 224, 3);
+
+  Preprocess prep;
+  prep.setup(output_frame);
+  uint64_t bytes = input_frame.size() + rpi_rt::logic::shufflenet::frame_bytes(output_frame);
+  bench("Preprocess 640x480", bytes, [&]{ prep.process(input_frame); });
+}
+
+TEST_CASE("Model", "[shufflenet][model]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Model;
+
+  Frame<float> input_frame(224, 224, 3);
+  Frame<float> output_frame(1, 1, 1);
+  fill_testdata(input_frame, "model_input");
+
+  Model<float>::Params params({4, 8, 4}, {24, 48, 96, 192, 64});
+  params.load([](const std::string& name, float* data, size_t size){
+    auto loaded = load_testdata("model/" + name);
+    REQUIRE(size == loaded.size());
+    std::copy(loaded.begin(), loaded.end(), data);
+  });
+
+  Model<float> m;
+  m.setup(input_frame, output_frame, params);
+  bench("Model 224x224x3", io_bytes(input_frame, output_frame), [&]{ m.forward(); });
+}
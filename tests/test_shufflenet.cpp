@@ -1,12 +1,15 @@
 #include "catch2/catch_test_macros.hpp"
 #include <algorithm>
 #include <cstdlib>
+#include <filesystem>
 #include <fstream>
 #include <iterator>
 #include <string>
 #include <iostream>
+#include <sstream>
 
 #include "frame.hpp"
+#include "testdata.hpp"
 #include "src/logic/shufflenet/depthwise_conv2d.hpp"
 #include "src/logic/shufflenet/maxpool2d.hpp"
 #include "src/logic/shufflenet/fc.hpp"
@@ -15,28 +18,13 @@
 #include "src/logic/shufflenet/branch1.hpp"
 #include "src/logic/shufflenet/branch2.hpp"
 #include "src/logic/shufflenet/inverted_residual.hpp"
+#include "src/logic/shufflenet/memory_planner.hpp"
 #include "src/logic/shufflenet/model.hpp"
+#include "src/logic/shufflenet/model_file.hpp"
+#include "src/logic/shufflenet/weights_cache.hpp"
+#include "src/logic/shufflenet/subgraph_model.hpp"
 #include "src/logic/shufflenet/preprocess.hpp"
 
-#ifndef TESTDATA_PATH
-  #define TESTDATA_PATH "testdata"
-#endif
-
-template<class Elem = float>
-std::vector<Elem> load_testdata(std::string path) {
-  std::ifstream ifs{std::string(TESTDATA_PATH) + "/" + path, std::ios::binary};
-  ifs.unsetf(std::ios::skipws);
-  ifs.seekg(0, std::ios::end);
-  auto size = ifs.tellg() / sizeof(Elem);
-  ifs.seekg(0, std::ios::beg);
-
-  std::vector<Elem> vec;
-  vec.resize(size);
-
-  std::copy(std::istream_iterator<char>(ifs), std::istream_iterator<char>(), (char *)vec.data());
-  return vec;
-}
-
 bool compare_result(const float* a, const float* b, size_t size, float eps = 0.001) {
   float max_error = 0;
   for (size_t i = 0; i < size; i++) {
@@ -47,6 +35,59 @@ bool compare_result(const float* a, const float* b, size_t size, float eps = 0.0
   return max_error < eps;
 }
 
+using ModelParams = rpi_rt::logic::shufflenet::Model<float>::Params;
+
+// the ShuffleNetV2OnFire weights of testdata/model, optionally listed for
+// ModelFile::write()
+void load_model_params(ModelParams& params,
+    std::vector<rpi_rt::logic::shufflenet::ModelFile::tensor_t>* tensors = nullptr) {
+  params.resize({4, 8, 4}, {24, 48, 96, 192, 64});
+  params.load([tensors](const std::string& name, float* data, size_t size){
+    auto loaded = load_testdata("model/" + name);
+    REQUIRE(size == loaded.size());
+    std::copy(loaded.begin(), loaded.end(), data);
+    if (tensors) {
+      tensors->push_back({name, data, size});
+    }
+  });
+}
+
+// model_input in every image of frame, returns the logit expected for it
+float load_model_input(rpi_rt::Frame<float>& frame) {
+  auto input = load_testdata("model_input");
+  REQUIRE(frame.size() % input.size() == 0);
+  for (size_t i = 0; i < frame.size(); i += input.size()) {
+    std::copy(input.begin(), input.end(), frame.data() + i);
+  }
+  return load_testdata("model_output")[0];
+}
+
+// model_input and preprocess_output taking turns over the images of frame,
+// returns the logit expected for each image. preprocess_output has no
+// stored logit, an unbatched Model run gives it
+std::vector<float> load_batch_inputs(rpi_rt::Frame<float>& frame, const ModelParams& params) {
+  rpi_rt::Frame<float> single(224, 224, 3);
+  rpi_rt::Frame<float> single_output(1, 1, 1);
+  float model_logit = load_model_input(single);
+  auto model_input = load_testdata("model_input");
+  auto other_input = load_testdata("preprocess_output");
+  REQUIRE(other_input.size() == single.size());
+  std::copy(other_input.begin(), other_input.end(), single.data());
+  rpi_rt::logic::shufflenet::Model<float> m;
+  m.setup(single, single_output, params);
+  m.forward();
+  float other_logit = single_output.data()[0];
+
+  REQUIRE(single.size() * frame.batch() == frame.size());
+  std::vector<float> expected;
+  for (size_t i = 0; i < frame.batch(); i++) {
+    const auto& input = i % 2 ? other_input : model_input;
+    std::copy(input.begin(), input.end(), frame.data() + i * input.size());
+    expected.push_back(i % 2 ? other_logit : model_logit);
+  }
+  return expected;
+}
+
 TEST_CASE("Maxpool2D", "[shufflenet][kernels]") {
   using rpi_rt::Frame;
   using rpi_rt::logic::shufflenet::Maxpool2D;
@@ -142,6 +183,36 @@ TEST_CASE("Conv2D", "[shufflenet][kernels]") {
   CHECK(compare_result(output_frame.data(), output_data.data(), output_data.size()));
 }
 
+TEST_CASE("Conv2DThreadpool", "[shufflenet][kernels][threadpool]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Conv2D;
+  using rpi_rt::logic::shufflenet::XNNPackGuard;
+
+  auto input_data = load_testdata("conv2d_input");
+  auto output_data = load_testdata("conv2d_output");
+  auto weight_data = load_testdata("conv2d_weight");
+
+  for (size_t threads : {1, 2, 4}) {
+    XNNPackGuard::instance().threads(threads);
+    CHECK(XNNPackGuard::instance().threads() == threads);
+
+    Frame<float> input_frame(56, 56, 24);
+    Frame<float> output_frame(56, 56, 24);
+
+    Conv2D<float>::Params params(24, 1, 1, 24);
+    std::copy(input_data.begin(), input_data.end(), input_frame.data());
+    std::copy(weight_data.begin(), weight_data.end(), params.data());
+
+    Conv2D<float> conv2d;
+    conv2d.setup(input_frame, output_frame, params);
+    conv2d.forward();
+
+    CHECK(compare_result(output_frame.data(), output_data.data(), output_data.size()));
+  }
+
+  XNNPackGuard::instance().threads(0);
+}
+
 TEST_CASE("FusedConv2DBatchNorm", "[shufflenet][kernels]") {
   using rpi_rt::Frame;
   using rpi_rt::logic::shufflenet::Conv2D;
@@ -356,6 +427,65 @@ TEST_CASE("InvertedResidualChunkingDemo", "[shufflenet][repeats]") {
   CHECK(compare_result(output_frame.data(), output_data.data(), output_data.size()));
 }
 
+TEST_CASE("ShuffleTails", "[shufflenet][kernels]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Shuffle;
+
+  // channel counts that are not a multiple of the vector width
+  for (size_t channels : {1, 5, 17, 24}) {
+    // a is read in place from the first half of a whole block input, like
+    // a block without branch1 does, or is a separate frame
+    for (size_t a_channels : {channels, 2 * channels}) {
+      Frame<float> input_a(3, 5, a_channels);
+      Frame<float> input_b(3, 5, channels);
+      Frame<float> output_frame(3, 5, 2 * channels);
+      for (size_t i = 0; i < input_a.size(); i++) {
+        input_a.data()[i] = float(i);
+      }
+      for (size_t i = 0; i < input_b.size(); i++) {
+        input_b.data()[i] = -float(i);
+      }
+
+      Shuffle<float> shuffle;
+      shuffle.setup(input_a, input_b, output_frame);
+      shuffle.forward();
+
+      bool ok = true;
+      for (size_t p = 0; p < 3 * 5; p++) {
+        for (size_t j = 0; j < channels; j++) {
+          ok &= output_frame.data()[p * 2 * channels + 2 * j + 0] == input_a.data()[p * a_channels + j];
+          ok &= output_frame.data()[p * 2 * channels + 2 * j + 1] == input_b.data()[p * channels + j];
+        }
+      }
+      CHECK(ok);
+    }
+  }
+}
+
+TEST_CASE("MemoryPlanner", "[shufflenet][planner]") {
+  using rpi_rt::logic::shufflenet::MemoryPlanner;
+
+  // a -> b -> c -> d, each 64 bytes: only neighbours are live together
+  MemoryPlanner<float> planner;
+  size_t a = planner.request(1, 4, 4, 1);
+  size_t b = planner.request(1, 4, 4, 1);
+  size_t c = planner.request(1, 4, 4, 1);
+  size_t d = planner.request(1, 4, 4, 1);
+  planner.use({a, b}, planner.schedule());
+  planner.use({b, c}, planner.schedule());
+  planner.use({c, d}, planner.schedule());
+  planner.plan();
+
+  CHECK(planner.total_bytes() == 4 * 64);
+  CHECK(planner.footprint() == 2 * 64);
+  CHECK(planner.frame(a).data() != planner.frame(b).data());
+  CHECK(planner.frame(b).data() != planner.frame(c).data());
+  CHECK(planner.frame(c).data() != planner.frame(d).data());
+  CHECK(planner.frame(a).data() == planner.frame(c).data());
+  CHECK(planner.frame(d).batch() == 1);
+  CHECK(planner.frame(d).size() == 16);
+}
+
 TEST_CASE("Model", "[shufflenet][model]") {
   using rpi_rt::Frame;
   using rpi_rt::logic::shufflenet::Model;
@@ -363,26 +493,402 @@ TEST_CASE("Model", "[shufflenet][model]") {
   Frame<float> input_frame(224, 224, 3);
   Frame<float> output_frame(1, 1, 1);
 
+  ModelParams params;
+  load_model_params(params);
+  float expected = load_model_input(input_frame);
+
+  Model<float> m;
+  m.setup(input_frame, output_frame, params);
+  m.forward();
+
+  float result = output_frame.data()[0];
+  std::cout << "Result: " << result << std::endl;
+  std::cout << "Activations: " << m.activation_bytes() << " bytes, "
+    << m.unplanned_activation_bytes() << " without reuse" << std::endl;
+
+  CHECK(std::abs(result - expected) < 0.01);
+  CHECK(m.activation_bytes() < m.unplanned_activation_bytes());
+}
+
+TEST_CASE("BatchedModel", "[shufflenet][model][batch]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Model;
+
+  const size_t batch = 3;
+  Frame<float> input_frame(batch, 224, 224, 3);
+  Frame<float> output_frame(batch, 1, 1, 1);
+
+  ModelParams params;
+  load_model_params(params);
+
+  // every slot must give the unbatched result of its own image
+  auto expected = load_batch_inputs(input_frame, params);
+  CHECK(std::abs(expected[0] - expected[1]) > 0.1);
+
+  Model<float> m;
+  m.setup(input_frame, output_frame, params);
+  m.forward();
+
+  for (size_t i = 0; i < batch; i++) {
+    CHECK(std::abs(output_frame.data()[i] - expected[i]) < 0.01);
+  }
+}
+
+TEST_CASE("ProfiledModel", "[shufflenet][model][profile]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Model;
+  using rpi_rt::logic::shufflenet::Profiler;
+
+  Frame<float> input_frame(224, 224, 3);
+  Frame<float> output_frame(1, 1, 1);
+
+  ModelParams params;
+  load_model_params(params);
+  float expected = load_model_input(input_frame);
+
+  Profiler profiler;
+  Model<float> m;
+  m.profile(profiler);
+  m.setup(input_frame, output_frame, params);
+  m.forward();
+  m.forward();
+
+  // profiling must not change the result
+  CHECK(std::abs(output_frame.data()[0] - expected) < 0.01);
+
+  // conv_pre, maxpool, 3 downsampling repeats of 6 operators, 13 of 4,
+  // conv_post, mean, fc
+  CHECK(profiler.size() == 2 + 3 * 6 + 13 * 4 + 3);
+
+  std::ostringstream table;
+  profiler.print_table(table);
+  std::cout << table.str();
+  CHECK(table.str().find("s2r0.branch1.dwconv") != std::string::npos);
+  CHECK(table.str().find("s3r1.branch2.conv1x1_0") != std::string::npos);
+
+  std::ostringstream trace;
+  profiler.write_chrome_trace(trace);
+  CHECK(trace.str().rfind("{\"traceEvents\":[", 0) == 0);
+  CHECK(trace.str().find("\"name\":\"s4r3.shuffle\"") != std::string::npos);
+}
+
+TEST_CASE("PackedModel", "[shufflenet][model][model_file]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Model;
+  using rpi_rt::logic::shufflenet::ModelFile;
+
+  Frame<float> input_frame(224, 224, 3);
+  Frame<float> output_frame(1, 1, 1);
+
+  ModelParams loaded;
+  std::vector<ModelFile::tensor_t> tensors;
+  load_model_params(loaded, &tensors);
+
+  std::string path = std::filesystem::temp_directory_path() / "test_shufflenet.model";
+  {
+    std::ofstream ofs{path, std::ios::binary};
+    ModelFile::write(ofs, tensors);
+  }
+
+  float expected = load_model_input(input_frame);
+
+  {
+    ModelFile file{path};
+    CHECK(file.size() == tensors.size());
+
+    // the weights are views of the mapping, not copies
+    Model<float>::Params params({4, 8, 4}, {24, 48, 96, 192, 64});
+    params.bind([&file](const std::string& name, size_t size) {
+      return file.tensor(name, size);
+    });
+    CHECK(params.conv_pre_params().data() == file.tensor("c1w", params.conv_pre_params().size()));
+
+    Model<float> m;
+    m.setup(input_frame, output_frame, params);
+    m.forward();
+    CHECK(std::abs(output_frame.data()[0] - expected) < 0.01);
+  }
+
+  // a flipped bit, as from a torn deploy, is caught on open
+  {
+    std::fstream fs{path, std::ios::in | std::ios::out | std::ios::binary};
+    fs.seekg(-1, std::ios::end);
+    char last = fs.get();
+    fs.seekp(-1, std::ios::end);
+    fs.put(last ^ 1);
+  }
+  CHECK_THROWS(ModelFile{path});
+  std::filesystem::remove(path);
+}
+
+// runs the packed model at path on model_input with its weights in cache,
+// which first loads path + ".xnncache" if there is one
+float run_cached_model(const std::string& path,
+    rpi_rt::logic::shufflenet::WeightsCache& cache, bool& loaded) {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Model;
+  using rpi_rt::logic::shufflenet::ModelFile;
+  using rpi_rt::logic::shufflenet::XNNPackGuard;
+
+  Frame<float> input_frame(224, 224, 3);
+  Frame<float> output_frame(1, 1, 1);
+  load_model_input(input_frame);
+
+  ModelFile file{path};
   Model<float>::Params params({4, 8, 4}, {24, 48, 96, 192, 64});
-  params.load([](const std::string& name, float* data, size_t size){
-    std::cout << "Loading " << name << std::endl;
-    auto loaded = load_testdata("model/" + name);
-    assert(size == loaded.size());
-    std::copy(loaded.begin(), loaded.end(), data);
+  params.bind([&file](const std::string& name, size_t size) {
+    return file.tensor(name, size);
   });
-
-  auto input = load_testdata("model_input");
-  auto output = load_testdata("model_output");
-  std::copy(input.begin(), input.end(), input_frame.data());
+  loaded = cache.load(path + ".xnncache", file);
 
   Model<float> m;
+  XNNPackGuard::instance().weights_cache(cache.provider());
+  m.setup(input_frame, output_frame, params);
+  XNNPackGuard::instance().weights_cache(nullptr);
+  m.forward();
+  return output_frame.data()[0];
+}
+
+TEST_CASE("CachedWeights", "[shufflenet][model][model_file]") {
+  using rpi_rt::logic::shufflenet::ModelFile;
+  using rpi_rt::logic::shufflenet::WeightsCache;
+
+  ModelParams loaded_params;
+  std::vector<ModelFile::tensor_t> tensors;
+  load_model_params(loaded_params, &tensors);
+
+  std::string path = std::filesystem::temp_directory_path() / "test_shufflenet_cached.model";
+  std::string cache_path = path + ".xnncache";
+  {
+    std::ofstream ofs{path, std::ios::binary};
+    ModelFile::write(ofs, tensors);
+  }
+  std::filesystem::remove(cache_path);
+
+  float expected = load_testdata("model_output")[0];
+
+  // the first run packs and saves, the second only looks up
+  size_t packed = 0;
+  {
+    WeightsCache cache;
+    bool loaded;
+    CHECK(std::abs(run_cached_model(path, cache, loaded) - expected) < 0.01);
+    CHECK_FALSE(loaded);
+    packed = cache.misses();
+    CHECK(packed > 0);
+    CHECK(cache.save(cache_path));
+  }
+  {
+    WeightsCache cache;
+    bool loaded;
+    CHECK(std::abs(run_cached_model(path, cache, loaded) - expected) < 0.01);
+    CHECK(loaded);
+    CHECK(cache.hits() == packed);
+    CHECK(cache.misses() == 0);
+    CHECK(!cache.save(cache_path));
+  }
+
+  // and so does a process that never packed, like the next start of the
+  // app. This binary runs CachedWeightsReload on the saved cache
+  auto self = std::filesystem::read_symlink("/proc/self/exe");
+  std::string cmd = "FLAME_IRIS_CACHED_MODEL='" + path + "'"
+    " FLAME_IRIS_CACHED_HITS=" + std::to_string(packed) +
+    " '" + self.string() + "' CachedWeightsReload";
+  CHECK(std::system(cmd.c_str()) == 0);
+
+  std::filesystem::remove(cache_path);
+  std::filesystem::remove(path);
+}
+
+// hidden, run by CachedWeights in a second process
+TEST_CASE("CachedWeightsReload", "[.][shufflenet][model][model_file]") {
+  using rpi_rt::logic::shufflenet::WeightsCache;
+
+  const char* path = std::getenv("FLAME_IRIS_CACHED_MODEL");
+  const char* hits = std::getenv("FLAME_IRIS_CACHED_HITS");
+  REQUIRE(path);
+  REQUIRE(hits);
+
+  WeightsCache cache;
+  bool loaded;
+  float result = run_cached_model(path, cache, loaded);
+  REQUIRE(loaded);
+  CHECK(std::abs(result - load_testdata("model_output")[0]) < 0.01);
+  CHECK(cache.hits() == std::stoul(hits));
+  CHECK(cache.misses() == 0);
+}
+
+TEST_CASE("SubgraphModel", "[shufflenet][model][subgraph]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::SubgraphModel;
+
+  Frame<float> input_frame(224, 224, 3);
+  Frame<float> output_frame(1, 1, 1);
+
+  ModelParams params;
+  load_model_params(params);
+  float expected = load_model_input(input_frame);
+
+  SubgraphModel<float> m;
+  m.setup(input_frame, output_frame, params);
+  m.forward();
+
+  float result = output_frame.data()[0];
+  std::cout << "Result: " << result << std::endl;
+
+  CHECK(std::abs(result - expected) < 0.01);
+}
+
+TEST_CASE("SubgraphModelsShareThreadpool", "[shufflenet][model][subgraph][threadpool]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::SubgraphModel;
+  using rpi_rt::logic::shufflenet::XNNPackGuard;
+
+  Frame<float> input_frame(224, 224, 3);
+  Frame<float> first_output(1, 1, 1);
+  Frame<float> second_output(1, 1, 1);
+
+  ModelParams params;
+  load_model_params(params);
+  float expected = load_model_input(input_frame);
+
+  auto& guard = XNNPackGuard::instance();
+  guard.threads(2);
+  {
+    SubgraphModel<float> first;
+    first.setup(input_frame, first_output, params);
+    first.forward();
+
+    // each model's setup asks for the count again, the runtime of the
+    // first keeps its pool
+    guard.threads(2);
+    SubgraphModel<float> second;
+    second.setup(input_frame, second_output, params);
+
+    CHECK_THROWS(guard.threads(4));
+    CHECK(guard.threads() == 2);
+
+    first.forward();
+    second.forward();
+    CHECK(std::abs(first_output.data()[0] - expected) < 0.01);
+    CHECK(std::abs(second_output.data()[0] - expected) < 0.01);
+  }
+  // free to change once they are gone
+  guard.threads(0);
+}
+
+TEST_CASE("BatchedSubgraphModel", "[shufflenet][model][subgraph][batch]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::SubgraphModel;
+
+  const size_t batch = 3;
+  Frame<float> input_frame(batch, 224, 224, 3);
+  Frame<float> output_frame(batch, 1, 1, 1);
+
+  ModelParams params;
+  load_model_params(params);
+  auto expected = load_batch_inputs(input_frame, params);
+
+  SubgraphModel<float> m;
   m.setup(input_frame, output_frame, params);
   m.forward();
 
+  for (size_t i = 0; i < batch; i++) {
+    CHECK(std::abs(output_frame.data()[i] - expected[i]) < 0.01);
+  }
+}
+
+TEST_CASE("QuantizedSubgraphModel", "[shufflenet][model][subgraph][qs8]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Calibration;
+  using rpi_rt::logic::shufflenet::SubgraphModel;
+
+  Frame<float> input_frame(224, 224, 3);
+  Frame<float> output_frame(1, 1, 1);
+
+  ModelParams params;
+  load_model_params(params);
+
+  // calibrate on model_input and its mirror image
+  auto image = load_testdata("model_input");
+  auto mirrored = image;
+  for (size_t y = 0; y < 224; y++) {
+    for (size_t x = 0; x < 224; x++) {
+      std::copy_n(image.data() + (y * 224 + x) * 3, 3, mirrored.data() + (y * 224 + 223 - x) * 3);
+    }
+  }
+  Calibration calibration;
+  {
+    SubgraphModel<float> fp32;
+    fp32.observe(calibration);
+    fp32.setup(input_frame, output_frame, params);
+    for (const auto* sample : {&image, &mirrored}) {
+      std::copy(sample->begin(), sample->end(), input_frame.data());
+      fp32.forward();
+    }
+  }
+
+  std::stringstream ss;
+  calibration.save(ss);
+  Calibration reloaded;
+  reloaded.load(ss);
+  REQUIRE(reloaded.size() == calibration.size());
+
+  // and evaluate on another image, against its fp32 logit
+  auto unseen = load_testdata("preprocess_output");
+  REQUIRE(unseen.size() == input_frame.size());
+  std::copy(unseen.begin(), unseen.end(), input_frame.data());
+
+  float expected;
+  {
+    SubgraphModel<float> fp32;
+    fp32.setup(input_frame, output_frame, params);
+    fp32.forward();
+    expected = output_frame.data()[0];
+  }
+
+  SubgraphModel<int8_t> qs8;
+  qs8.calibration(reloaded);
+  qs8.setup(input_frame, output_frame, params);
+  qs8.forward();
+
+  float result = output_frame.data()[0];
+  std::cout << "Result: " << result << " fp32: " << expected << std::endl;
+
+  // same decision as fp32, within 5% of its logit plus 0.1 for rounding
+  CHECK((result < 0) == (expected < 0));
+  CHECK(std::abs(result - expected) <= 0.05 * std::abs(expected) + 0.1);
+}
+
+TEST_CASE("HalfSubgraphModel", "[shufflenet][model][subgraph][fp16]") {
+  using rpi_rt::Frame;
+  using rpi_rt::logic::shufflenet::Float16;
+  using rpi_rt::logic::shufflenet::SubgraphModel;
+
+  Frame<float> input_frame(224, 224, 3);
+  Frame<float> output_frame(1, 1, 1);
+
+  ModelParams params;
+  load_model_params(params);
+  float expected = load_model_input(input_frame);
+
+  SubgraphModel<Float16> fp16;
+  try {
+    fp16.setup(input_frame, output_frame, params);
+  } catch (const std::runtime_error& e) {
+    if (std::string(e.what()).find("unsupported") == std::string::npos) {
+      throw;
+    }
+    SKIP("no fp16 arithmetic on this CPU");
+  }
+  fp16.forward();
+
   float result = output_frame.data()[0];
   std::cout << "Result: " << result << std::endl;
 
-  CHECK(std::abs(result - output[0]) < 0.01);
+  // fp16 keeps about 3 significant digits through the network
+  CHECK((result < 0) == (expected < 0));
+  CHECK(std::abs(result - expected) < 0.25);
 }
 
 TEST_CASE("Preprocess", "[shufflenet][preprocess]") {
@@ -403,3 +909,26 @@ TEST_CASE("Preprocess", "[shufflenet][preprocess]") {
   CHECK(compare_result(output_frame.data(), output.data(), output.size(), 0.03));
 }
 
+TEST_CASE("PreprocessNormalize", "[shufflenet][preprocess]") {
+  using rpi_rt::logic::shufflenet::Preprocess;
+
+  // an odd pixel count exercises the scalar tail after the SIMD loop
+  const size_t pixels = 224 * 224 + 7;
+  std::vector<uint8_t> input(pixels * 3);
+  for (size_t i = 0; i < input.size(); i++) {
+    input[i] = uint8_t(i * 37);
+  }
+
+  std::vector<float> output(input.size());
+  Preprocess::normalize(input.data(), output.data(), pixels);
+
+  const double mean[3] = {0.485, 0.456, 0.406};
+  const double stddev[3] = {0.229, 0.224, 0.225};
+  std::vector<float> expected(input.size());
+  for (size_t i = 0; i < input.size(); i++) {
+    expected[i] = (input[i] / 255.0 - mean[i % 3]) / stddev[i % 3];
+  }
+
+  CHECK(compare_result(output.data(), expected.data(), expected.size(), 1e-5));
+}
+
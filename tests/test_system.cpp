@@ -1,17 +1,35 @@
 #include "catch2/catch_test_macros.hpp"
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <cstdlib>
 #include <fstream>
 #include <iterator>
 #include <string>
 #include <iostream>
 #include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <future>
 #include <sstream>
 
 #include "detection_result.hpp"
 #include "frame.hpp"
 #include "alarm.hpp"
 #include "sensor.hpp"
+#include "mailbox.hpp"
+#include "thread_actor.hpp"
+#include "src/sensor/capture_scaler.hpp"
+
+#define CPPHTTPLIB_OPENSSL_SUPPORT
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#include "third_party/httplib.h"
+#pragma GCC diagnostic pop
+#include "third_party/json.hpp"
 
 #ifndef TESTDATA_PATH
   #define TESTDATA_PATH "testdata"
@@ -31,6 +49,132 @@ TEST_CASE("Frame", "[system][frame]") {
   CHECK(u8_frame.size() == 300 * 200 * 1);
 }
 
+TEST_CASE("FrameSharedBuffer", "[system][frame]") {
+  std::vector<uint8_t> storage(4 * 4 * 3);
+  int released = 0;
+  {
+    std::shared_ptr<uint8_t> buffer{storage.data(), [&released](uint8_t*) {
+      released++;
+    }};
+    rpi_rt::Frame<uint8_t> view{4, 4, 3, std::move(buffer)};
+    CHECK(view.data() == storage.data());
+    CHECK(view.size() == storage.size());
+
+    auto copy = view;
+    CHECK(copy.data() == storage.data());
+
+    auto cloned = view.clone();
+    CHECK(cloned.data() != storage.data());
+    CHECK(std::equal(storage.begin(), storage.end(), cloned.data()));
+    CHECK(released == 0);
+  }
+  CHECK(released == 1);
+}
+
+TEST_CASE("FramePool", "[system][frame]") {
+  rpi_rt::FramePool<uint8_t> pool{48, 64, 3};
+
+  const uint8_t* first_data = nullptr;
+  {
+    auto first = pool.acquire();
+    CHECK(first.height() == 48);
+    CHECK(first.width() == 64);
+    CHECK(first.channels() == 3);
+    CHECK(reinterpret_cast<uintptr_t>(first.data()) % 64 == 0);
+    first_data = first.data();
+
+    // still viewed, so a second buffer is needed
+    auto second = pool.acquire();
+    CHECK(second.data() != first_data);
+    CHECK(pool.capacity() == 2);
+  }
+
+  // both returned, steady state reuses them
+  for (int i = 0; i < 10; i++) {
+    auto frame = pool.acquire();
+    auto copy = frame;
+    CHECK(copy.data() == first_data);
+  }
+  CHECK(pool.capacity() == 2);
+}
+
+TEST_CASE("LatestMailbox", "[system][threads]") {
+  rpi_rt::LatestMailbox<int> mailbox;
+
+  CHECK_FALSE(mailbox.post(1));
+  CHECK(mailbox.post(2));
+  CHECK(mailbox.post(3));
+  CHECK(mailbox.wait() == 3);
+  CHECK(mailbox.posted() == 3);
+  CHECK(mailbox.dropped() == 2);
+
+  CHECK_FALSE(mailbox.wait_for(std::chrono::milliseconds{10}).has_value());
+
+  std::thread consumer{[&mailbox](){
+    int last = 0;
+    while (auto item = mailbox.wait()) {
+      CHECK(*item > last);
+      last = *item;
+    }
+    CHECK(last == 1000);
+  }};
+  for (int i = 4; i <= 1000; i++) {
+    mailbox.post(i);
+  }
+  mailbox.close();
+  consumer.join();
+}
+
+TEST_CASE("AlarmMailbox", "[system][threads][alarm]") {
+  SECTION("urgent events are never lost") {
+    rpi_rt::AlarmMailbox<int> mailbox{2};
+    CHECK(mailbox.post(1, true));
+    CHECK(mailbox.post(2, false));
+    // full, a non-urgent event goes, an urgent one evicts the non-urgent
+    CHECK_FALSE(mailbox.post(3, false));
+    CHECK_FALSE(mailbox.post(4, true));
+    CHECK(mailbox.wait() == 1);
+    CHECK(mailbox.wait() == 4);
+    CHECK_FALSE(mailbox.wait_for(std::chrono::milliseconds{10}).has_value());
+    CHECK(mailbox.posted() == 4);
+    CHECK(mailbox.coalesced() == 0);
+    CHECK(mailbox.dropped() == 2);
+  }
+
+  SECTION("bursts coalesce") {
+    rpi_rt::AlarmMailbox<int> mailbox{16, true};
+    CHECK(mailbox.post(1, true));
+    CHECK_FALSE(mailbox.post(2, true));
+    CHECK(mailbox.post(3, false));
+    CHECK_FALSE(mailbox.post(4, false));
+    CHECK(mailbox.post(5, true));
+    CHECK(mailbox.wait() == 2);
+    CHECK(mailbox.wait() == 4);
+    CHECK(mailbox.wait() == 5);
+    CHECK(mailbox.coalesced() == 2);
+    CHECK(mailbox.dropped() == 0);
+  }
+
+  SECTION("close drains") {
+    rpi_rt::AlarmMailbox<int> mailbox;
+    for (int i = 1; i <= 10; i++) {
+      mailbox.post(i, i % 2);
+    }
+    mailbox.close();
+    std::thread consumer{[&mailbox](){
+      int last = 0;
+      while (auto item = mailbox.wait()) {
+        CHECK(*item == last + 1);
+        last = *item;
+      }
+      CHECK(last == 10);
+    }};
+    consumer.join();
+    CHECK_FALSE(mailbox.post(11, true));
+    CHECK(mailbox.dropped() == 1);
+  }
+}
+
 class mock_detection_result : public rpi_rt::detection_result_t {
   public:
     ~mock_detection_result() {}
@@ -44,6 +188,60 @@ class mock_detection_result : public rpi_rt::detection_result_t {
     }
 };
 
+TEST_CASE("LatencyTrace", "[system][latency]") {
+  namespace la = rpi_rt::latency_assessment;
+  const auto path = std::filesystem::temp_directory_path() / "flame_iris_test_latency.trace";
+  const uint64_t per_thread = 10000;
+  // removed even if a REQUIRE below fails
+  struct remove_at_exit {
+    std::filesystem::path path;
+    ~remove_at_exit() {
+      std::error_code ec;
+      std::filesystem::remove(path, ec);
+    }
+  } cleanup{path};
+
+  la::begin_assessment(path.string());
+  auto record = [&](la::trace_stage_t stage) {
+    for (uint64_t id = 1; id <= per_thread; id++) {
+      la::report_timepoint(id, stage);
+      if (id % 1000 == 0) {
+        // let the drainer keep up with the ring
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+      }
+    }
+  };
+  std::thread capture{record, la::trace_stage_t::capture};
+  std::thread alarm{record, la::trace_stage_t::alarm};
+  capture.join();
+  alarm.join();
+  uint64_t dropped = la::end_assessment();
+  // off again, must not be recorded
+  la::report_timepoint(0, la::trace_stage_t::capture);
+
+  std::ifstream f{path, std::ios::binary};
+  char magic[8];
+  uint32_t header[2];
+  f.read(magic, sizeof(magic));
+  f.read(reinterpret_cast<char*>(header), sizeof(header));
+  CHECK(std::equal(magic, magic + 8, la::trace_magic));
+  CHECK(header[0] == la::trace_version);
+  CHECK(header[1] == sizeof(la::trace_record_t));
+
+  uint64_t counts[2] = {0, 0};
+  uint64_t last_time[2] = {0, 0};
+  la::trace_record_t r;
+  while (f.read(reinterpret_cast<char*>(&r), sizeof(r))) {
+    REQUIRE(r.stage < 2);
+    CHECK(r.frame_id != 0);
+    // one ring per thread keeps each thread's records in order
+    CHECK(r.time_ns >= last_time[r.stage]);
+    last_time[r.stage] = r.time_ns;
+    counts[r.stage]++;
+  }
+  CHECK(counts[0] + counts[1] + dropped == 2 * per_thread);
+}
+
 TEST_CASE("PassDetectionResult", "[system][alarm][detection_result]") {
   auto alarm = rpi_rt::create_stdout_alarm();
   std::thread th{[&alarm](){
@@ -64,6 +262,406 @@ TEST_CASE("PassDetectionResult", "[system][alarm][detection_result]") {
   CHECK(oss.str().find("!!TEST!!") != std::string::npos);
 }
 
+// takes delay to handle each result, like an email alarm on a cold connection
+class mock_alarm : public rpi_rt::alarm_t {
+  public:
+    explicit mock_alarm(std::chrono::milliseconds delay) : delay_(delay) {}
+
+    virtual void run() override {
+      while (auto result = mailbox_.wait()) {
+        std::this_thread::sleep_for(delay_);
+        handled_++;
+      }
+    }
+
+    virtual void report(std::shared_ptr<rpi_rt::detection_result_t> result) override {
+      mailbox_.post(std::move(result), true);
+    }
+
+    virtual void close() override {
+      mailbox_.close();
+    }
+
+    std::atomic<int> handled_{0};
+
+  private:
+    std::chrono::milliseconds delay_;
+    rpi_rt::AlarmMailbox<std::shared_ptr<rpi_rt::detection_result_t>> mailbox_;
+};
+
+TEST_CASE("AlarmFanOut", "[system][alarm][threads]") {
+  auto slow = std::make_shared<mock_alarm>(std::chrono::seconds{2});
+  auto fast = std::make_shared<mock_alarm>(std::chrono::milliseconds{0});
+  rpi_rt::alarm_thread_t dispatcher;
+  dispatcher.add_alarm(slow);
+  dispatcher.add_alarm(fast);
+  REQUIRE(dispatcher.size() == 2);
+  dispatcher.run();
+
+  auto start = std::chrono::steady_clock::now();
+  dispatcher.report(std::make_unique<mock_detection_result>());
+  dispatcher.report(std::make_unique<mock_detection_result>());
+  while (fast->handled_ < 2 && std::chrono::steady_clock::now() - start < std::chrono::seconds{1}) {
+    std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  }
+  // the slow alarm is still on the first result
+  CHECK(fast->handled_ == 2);
+  CHECK(slow->handled_ == 0);
+
+  dispatcher.close();
+  CHECK(slow->handled_ == 2);
+  // counted once, not once per alarm
+  CHECK(dispatcher.stats().reported == 2);
+}
+
+// records the buzzer calls with their time
+class fake_buzzer {
+  public:
+    using call_t = std::pair<std::chrono::steady_clock::time_point, bool>;
+
+    void set(bool on) {
+      std::unique_lock lg{mut_};
+      calls_.emplace_back(std::chrono::steady_clock::now(), on);
+    }
+
+    std::vector<call_t> calls() {
+      std::unique_lock lg{mut_};
+      return calls_;
+    }
+
+    size_t beeps() {
+      auto c = calls();
+      return std::count_if(c.begin(), c.end(), [](const call_t& call) { return call.second; });
+    }
+
+  private:
+    std::mutex mut_;
+    std::vector<call_t> calls_;
+};
+
+// records when the alarm takes it from its queue
+class timed_detection_result : public rpi_rt::detection_result_t {
+  public:
+    explicit timed_detection_result(bool fire) : fire_(fire) {}
+
+    virtual bool has_fire() override {
+      return fire_;
+    }
+
+    virtual std::string explain() override {
+      return fire_ ? "fire" : "no fire";
+    }
+
+    virtual uint64_t frame_id() const noexcept override {
+      taken_ = std::chrono::steady_clock::now().time_since_epoch().count();
+      return 0;
+    }
+
+    std::chrono::steady_clock::time_point taken() const {
+      return std::chrono::steady_clock::time_point{std::chrono::steady_clock::duration{taken_}};
+    }
+
+  private:
+    bool fire_;
+    mutable std::atomic<std::chrono::steady_clock::rep> taken_{0};
+};
+
+// a buzzer alarm beeping into a fake, running until destroyed
+struct fake_buzzer_alarm {
+  explicit fake_buzzer_alarm(const rpi_rt::buzzer_config_t& cfg)
+    : alarm(rpi_rt::create_buzzer_alarm(cfg, [this](bool on) { buzzer.set(on); })),
+      thread([this](){ alarm->run(); }) {}
+
+  ~fake_buzzer_alarm() {
+    alarm->close();
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  fake_buzzer buzzer;
+  std::shared_ptr<rpi_rt::alarm_t> alarm;
+  std::thread thread;
+};
+
+TEST_CASE("BuzzerAlarm", "[system][alarm][buzzer]") {
+  using namespace std::chrono_literals;
+  using clock = std::chrono::steady_clock;
+  auto near = [](clock::duration d, clock::duration expected) {
+    return d >= expected - 5ms && d <= expected + 30ms;
+  };
+
+  rpi_rt::buzzer_config_t cfg;
+  cfg.pattern = {80ms, 40ms};
+  cfg.hold = 300ms;
+
+  SECTION("cycles the pattern until the hold passed") {
+    fake_buzzer_alarm f{cfg};
+    auto start = clock::now();
+    f.alarm->report(std::make_shared<timed_detection_result>(true));
+    std::this_thread::sleep_for(600ms);
+
+    // whole cycles covering the 300ms hold, each step on time
+    auto calls = f.buzzer.calls();
+    REQUIRE(calls.size() == 6);
+    CHECK(near(calls[0].first - start, 0ms));
+    for (size_t i = 0; i < calls.size(); i++) {
+      CHECK(calls[i].second == (i % 2 == 0));
+      if (i > 0) {
+        CHECK(near(calls[i].first - calls[i - 1].first, cfg.pattern[(i - 1) % 2]));
+      }
+    }
+  }
+
+  SECTION("a fire result extends the hold") {
+    fake_buzzer_alarm f{cfg};
+    f.alarm->report(std::make_shared<timed_detection_result>(true));
+    std::this_thread::sleep_for(260ms);
+    f.alarm->report(std::make_shared<timed_detection_result>(true));
+    // no-fire results change nothing
+    f.alarm->report(std::make_shared<timed_detection_result>(false));
+    std::this_thread::sleep_for(600ms);
+
+    // the hold now ends at 560ms, in the fifth cycle
+    CHECK(f.buzzer.beeps() == 5);
+    CHECK_FALSE(f.buzzer.calls().back().second);
+  }
+
+  SECTION("stays quiet without fire") {
+    fake_buzzer_alarm f{cfg};
+    f.alarm->report(std::make_shared<timed_detection_result>(false));
+    std::this_thread::sleep_for(100ms);
+    CHECK(f.buzzer.calls().empty());
+  }
+
+  SECTION("reacts mid-beep") {
+    cfg.pattern = {1000ms, 1000ms};
+    fake_buzzer_alarm f{cfg};
+    f.alarm->report(std::make_shared<timed_detection_result>(true));
+    std::this_thread::sleep_for(200ms);
+    auto result = std::make_shared<timed_detection_result>(true);
+    auto reported = clock::now();
+    f.alarm->report(result);
+    std::this_thread::sleep_for(100ms);
+    CHECK(near(result->taken() - reported, 0ms));
+    // still the first beep
+    CHECK(f.buzzer.calls().size() == 1);
+  }
+
+  SECTION("close while sounding") {
+    cfg.pattern = {1000ms, 1000ms};
+    fake_buzzer_alarm f{cfg};
+    f.alarm->report(std::make_shared<timed_detection_result>(true));
+    std::this_thread::sleep_for(200ms);
+    auto closed = clock::now();
+    f.alarm->close();
+    f.thread.join();
+
+    auto calls = f.buzzer.calls();
+    REQUIRE(calls.size() == 2);
+    CHECK(calls[0].second);
+    CHECK_FALSE(calls[1].second);
+    CHECK(near(calls[1].first - closed, 0ms));
+  }
+}
+
+// stands in for the Brevo API, the first email fails with 503
+template <class Server>
+class brevo_stand_in {
+  public:
+    template <class... Args>
+    explicit brevo_stand_in(Args&&... args) : server_(std::forward<Args>(args)...) {
+      // one request per connection, every email reconnects
+      server_.set_keep_alive_max_count(1);
+      server_.Get("/v3/account", [](const httplib::Request&, httplib::Response& res) {
+        res.set_content("{}", "application/json");
+      });
+      server_.Post("/v3/smtp/email", [this](const httplib::Request& req, httplib::Response& res) {
+        {
+          std::unique_lock lg{mut_};
+          if (posts_ == 0) {
+            res.status = httplib::ServiceUnavailable_503;
+          } else {
+            api_key_ = req.get_header_value("api-key");
+            subject_ = nlohmann::json::parse(req.body)["subject"];
+#ifdef CPPHTTPLIB_SSL_ENABLED
+            if (req.ssl) {
+              resumed_ = SSL_session_reused(static_cast<SSL*>(const_cast<void*>(req.ssl)));
+            }
+#endif
+            res.status = httplib::Created_201;
+            res.set_content("{}", "application/json");
+          }
+          // counted once handled, a waiter sees what the post wrote
+          posts_++;
+        }
+        cond_.notify_all();
+      });
+      port_ = server_.bind_to_any_port("127.0.0.1");
+      thread_ = std::thread([this](){
+        server_.listen_after_bind();
+      });
+      server_.wait_until_ready();
+    }
+
+    ~brevo_stand_in() {
+      server_.stop();
+      thread_.join();
+    }
+
+    // waits for a number of posts handled, the failed one included
+    bool wait_posts(int n) {
+      std::unique_lock lg{mut_};
+      return cond_.wait_for(lg, std::chrono::seconds{5}, [this, n]{ return posts_ >= n; });
+    }
+
+    // of the last successful post
+    std::string api_key() {
+      std::unique_lock lg{mut_};
+      return api_key_;
+    }
+
+    std::string subject() {
+      std::unique_lock lg{mut_};
+      return subject_;
+    }
+
+    bool resumed() {
+      std::unique_lock lg{mut_};
+      return resumed_;
+    }
+
+    int port_ = 0;
+
+  private:
+    std::mutex mut_;
+    std::condition_variable cond_;
+    int posts_ = 0;
+    std::string api_key_;
+    std::string subject_;
+    bool resumed_ = false;
+    Server server_;
+    std::thread thread_;
+};
+
+TEST_CASE("BrevoEmailAlarm", "[system][alarm][brevo]") {
+  rpi_rt::brevo_config_t cfg;
+  cfg.api_key = "test-key";
+  cfg.cooldown = std::chrono::seconds{0};
+  cfg.retries = 1;
+  cfg.retry_backoff = std::chrono::milliseconds{10};
+
+  SECTION("retries over plain HTTP") {
+    brevo_stand_in<httplib::Server> api;
+    cfg.api_host = "127.0.0.1";
+    cfg.api_port = api.port_;
+    cfg.api_tls = false;
+
+    auto alarm = rpi_rt::create_brevo_email_alarm(cfg);
+    std::thread th{[&alarm](){
+      alarm->run();
+    }};
+    alarm->report(std::make_unique<mock_detection_result>());
+    CHECK(api.wait_posts(2));
+    alarm->close();
+    th.join();
+
+    CHECK(api.api_key() == "test-key");
+    CHECK(api.subject().find("FlameIris") != std::string::npos);
+  }
+
+  SECTION("resumes TLS sessions") {
+    brevo_stand_in<httplib::SSLServer> api{TESTDATA_PATH "/brevo_test.crt", TESTDATA_PATH "/brevo_test.key"};
+    cfg.api_host = "localhost";
+    cfg.api_port = api.port_;
+    cfg.ca_cert_path = TESTDATA_PATH "/brevo_test.crt";
+
+    auto alarm = rpi_rt::create_brevo_email_alarm(cfg);
+    std::thread th{[&alarm](){
+      alarm->run();
+    }};
+    alarm->report(std::make_unique<mock_detection_result>());
+    CHECK(api.wait_posts(2));
+    alarm->close();
+    th.join();
+
+    // warm up, failed post and retry each had their own connection
+    CHECK(api.subject().find("FlameIris") != std::string::npos);
+    CHECK(api.resumed());
+  }
+}
+
+// returns the logits it was given, one per frame
+class fixed_logit_model : public rpi_rt::visual_classfying_model_t {
+  public:
+    explicit fixed_logit_model(std::vector<float> logits) : logits_(std::move(logits)) {}
+
+    virtual void setup(const std::string&) override {}
+
+    virtual float process(const rpi_rt::Frame<uint8_t>&) override {
+      return logits_.at(next_++ % logits_.size());
+    }
+
+  private:
+    std::vector<float> logits_;
+    size_t next_ = 0;
+};
+
+TEST_CASE("DetectionAttachment", "[system][logic][detection_result]") {
+  rpi_rt::visual_classify_logic_t logic;
+  logic.model(std::make_shared<fixed_logit_model>(std::vector<float>{-1.0f, 1.0f}));
+  std::vector<std::shared_ptr<rpi_rt::detection_result_t>> results;
+  logic.set_detection_result_callback([&results](std::unique_ptr<rpi_rt::detection_result_t> r) {
+    results.push_back(std::move(r));
+  });
+
+  rpi_rt::Frame<uint8_t> frame{16, 16, 3};
+  std::fill(frame.data(), frame.data() + frame.size(), 128);
+  logic.process_batch({{0, 1, frame}, {1, 2, frame}});
+  REQUIRE(results.size() == 2);
+  REQUIRE(results[0]->has_fire());
+  REQUIRE_FALSE(results[1]->has_fire());
+
+  // encoded once, every caller shares the bytes
+  auto jpg = results[0]->jpg_attachment();
+  REQUIRE(jpg);
+  CHECK(jpg->size() > 2);
+  CHECK((*jpg)[0] == 0xff);
+  CHECK((*jpg)[1] == 0xd8);
+  CHECK(results[0]->jpg_attachment() == jpg);
+
+  // no fire, nothing to encode or keep
+  CHECK(results[1]->jpg_attachment() == nullptr);
+}
+
+TEST_CASE("DetectionResultFrames", "[system][logic][alarm][threads]") {
+  // stands in for the capture buffers, V4L2 requests 10 of them
+  constexpr uint64_t capture_buffers = 10;
+  rpi_rt::FramePool<uint8_t> buffers{16, 16, 3};
+
+  rpi_rt::visual_classify_logic_t logic;
+  logic.model(std::make_shared<fixed_logit_model>(std::vector<float>{-1.0f, 1.0f}));
+  auto slow = std::make_shared<mock_alarm>(std::chrono::milliseconds{50});
+  rpi_rt::alarm_thread_t dispatcher;
+  dispatcher.add_alarm(slow);
+  logic.set_detection_result_callback([&dispatcher](std::unique_ptr<rpi_rt::detection_result_t> r) {
+    dispatcher.report(std::move(r));
+  });
+  dispatcher.run();
+
+  // half fire, half no fire, more than the buffers while the alarm is busy
+  for (uint64_t frame_id = 1; frame_id <= 4 * capture_buffers; frame_id++) {
+    auto frame = buffers.acquire();
+    std::fill(frame.data(), frame.data() + frame.size(), 128);
+    logic.process_batch({{0, frame_id, std::move(frame)}});
+  }
+  // the queued results pin no buffer, every capture got the same one
+  CHECK(slow->handled_ < static_cast<int>(capture_buffers));
+  CHECK(buffers.capacity() == 1);
+
+  dispatcher.close();
+}
+
 TEST_CASE("MockTempSensor", "[system][sensor]") {
   auto sensor = rpi_rt::create_mock_temperature_sensor();
   size_t got_data = 0;
@@ -97,3 +695,118 @@ TEST_CASE("MockCameraSensor", "[system][sensor][ffmpeg]") {
   CHECK(got_frame > 0);
 }
 
+namespace {
+  // packed YUYV with a white top left quadrant on black, lines padded
+  std::vector<uint8_t> yuyv_quadrant(size_t width, size_t height, size_t stride) {
+    std::vector<uint8_t> data(stride * height, 0);
+    for (size_t y = 0; y < height; y++) {
+      for (size_t x = 0; x < width; x++) {
+        bool white = y < height / 2 && x < width / 2;
+        data[y * stride + x * 2] = white ? 235 : 16;
+        data[y * stride + x * 2 + 1] = 128;
+      }
+    }
+    return data;
+  }
+
+  // RGB of the frame matches the quadrant, scaled to its size
+  void check_quadrant(const rpi_rt::Frame<uint8_t>& frame) {
+    for (size_t y = 0; y < frame.height(); y++) {
+      for (size_t x = 0; x < frame.width(); x++) {
+        bool white = y < frame.height() / 2 && x < frame.width() / 2;
+        for (size_t c = 0; c < 3; c++) {
+          int value = frame.data()[(y * frame.width() + x) * 3 + c];
+          CHECK(std::abs(value - (white ? 255 : 0)) <= 8);
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("CaptureScaler", "[system][sensor][ffmpeg]") {
+  constexpr size_t width = 64, height = 32, stride = width * 2 + 32;
+  auto data = yuyv_quadrant(width, height, stride);
+
+  SECTION("full size when not downscaling") {
+    rpi_rt::capture_scaler_t scaler{AV_PIX_FMT_YUYV422, width, height, stride, 0, 0,
+      std::chrono::milliseconds{0}};
+    scaler.start();
+    auto frame = scaler.convert(data.data());
+    CHECK(frame.height() == height);
+    CHECK(frame.width() == width);
+    check_quadrant(frame);
+    CHECK_FALSE(scaler.schedule(1, data.data(), []{}));
+    CHECK_FALSE(scaler.capture_full_resolution().valid());
+  }
+
+  SECTION("downscales in one pass") {
+    rpi_rt::capture_scaler_t scaler{AV_PIX_FMT_YUYV422, width, height, stride, 16, 8,
+      std::chrono::milliseconds{0}};
+    auto frame = scaler.convert(data.data());
+    CHECK(frame.height() == 8);
+    CHECK(frame.width() == 16);
+    CHECK(frame.channels() == 3);
+    check_quadrant(frame);
+    // nothing asks for full resolution
+    CHECK_FALSE(scaler.schedule(1, data.data(), []{}));
+  }
+
+  SECTION("previews and full resolution captures borrow the buffer") {
+    rpi_rt::capture_scaler_t scaler{AV_PIX_FMT_YUYV422, width, height, stride, 16, 8,
+      std::chrono::hours{1}};
+    std::promise<std::pair<uint64_t, rpi_rt::Frame<uint8_t>>> preview;
+    scaler.set_preview_callback([&preview](uint64_t frame_id, rpi_rt::Frame<uint8_t> frame) {
+      preview.set_value({frame_id, std::move(frame)});
+    });
+    scaler.start();
+
+    auto full = scaler.capture_full_resolution();
+    REQUIRE(full.valid());
+    std::promise<void> released;
+    REQUIRE(scaler.schedule(7, data.data(), [&released]{ released.set_value(); }));
+    CHECK(released.get_future().wait_for(std::chrono::seconds{5}) == std::future_status::ready);
+
+    REQUIRE(full.wait_for(std::chrono::seconds{5}) == std::future_status::ready);
+    CHECK(full.get().height() == height);
+    CHECK(full.get().width() == width);
+    check_quadrant(full.get());
+
+    auto previewed = preview.get_future();
+    REQUIRE(previewed.wait_for(std::chrono::seconds{5}) == std::future_status::ready);
+    auto [frame_id, frame] = previewed.get();
+    CHECK(frame_id == 7);
+    CHECK(frame.height() == height);
+    CHECK(frame.width() == width);
+    check_quadrant(frame);
+
+    // the next preview is an hour away and nobody waits for a capture
+    CHECK_FALSE(scaler.schedule(8, data.data(), []{}));
+  }
+
+  SECTION("a buffer lent right before stop is still released") {
+    rpi_rt::capture_scaler_t scaler{AV_PIX_FMT_YUYV422, width, height, stride, 16, 8,
+      std::chrono::milliseconds{0}};
+    scaler.set_preview_callback([](uint64_t, rpi_rt::Frame<uint8_t>) {});
+    scaler.start();
+
+    bool released = false;
+    REQUIRE(scaler.schedule(1, data.data(), [&released]{ released = true; }));
+    scaler.stop();
+    CHECK(released);
+
+    // after stop nothing is borrowed or waited for
+    CHECK_FALSE(scaler.schedule(2, data.data(), []{}));
+    CHECK_FALSE(scaler.capture_full_resolution().valid());
+  }
+
+  SECTION("captures waited for at stop are broken") {
+    rpi_rt::capture_scaler_t scaler{AV_PIX_FMT_YUYV422, width, height, stride, 16, 8,
+      std::chrono::milliseconds{0}};
+    scaler.start();
+    auto abandoned = scaler.capture_full_resolution();
+    REQUIRE(abandoned.valid());
+    scaler.stop();
+    CHECK_THROWS_AS(abandoned.get(), std::future_error);
+  }
+}
+
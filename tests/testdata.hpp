@@ -0,0 +1,38 @@
+#pragma once
+
+#include "catch2/catch_test_macros.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "frame.hpp"
+
+// Reads the tensors under testdata/, shared by the tests and the bench.
+
+#ifndef TESTDATA_PATH
+  #define TESTDATA_PATH "testdata"
+#endif
+
+template<class Elem = float>
+std::vector<Elem> load_testdata(std::string path) {
+  std::ifstream ifs{std::string(TESTDATA_PATH) + "/" + path, std::ios::binary};
+  ifs.unsetf(std::ios::skipws);
+  ifs.seekg(0, std::ios::end);
+  auto size = ifs.tellg() / sizeof(Elem);
+  ifs.seekg(0, std::ios::beg);
+
+  std::vector<Elem> vec;
+  vec.resize(size);
+
+  std::copy(std::istream_iterator<char>(ifs), std::istream_iterator<char>(), (char *)vec.data());
+  return vec;
+}
+
+template<class Elem>
+void fill_testdata(rpi_rt::Frame<Elem>& frame, const std::string& path) {
+  auto data = load_testdata<Elem>(path);
+  REQUIRE(data.size() == frame.size());
+  std::copy(data.begin(), data.end(), frame.data());
+}